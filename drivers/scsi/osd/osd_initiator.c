@@ -40,6 +40,7 @@
  */
 
 #include <linux/slab.h>
+#include <linux/mempool.h>
 
 #include <scsi/osd_initiator.h>
 #include <scsi/osd_sec.h>
@@ -56,6 +57,12 @@
 
 enum { OSD_REQ_RETRIES = 1 };
 
+/* Requests reserved so writeback can progress under memory pressure */
+enum { OSD_REQ_POOL_MIN = 16 };
+
+static struct kmem_cache *osd_request_cachep;
+static mempool_t *osd_request_pool;
+
 MODULE_AUTHOR("Boaz Harrosh <bharrosh@panasas.com>");
 MODULE_DESCRIPTION("open-osd initiator library libosd.ko");
 MODULE_LICENSE("GPL");
@@ -396,14 +403,19 @@ static struct osd_request *_osd_request_alloc(gfp_t gfp)
 {
 	struct osd_request *or;
 
-	/* TODO: Use mempool with one saved request */
-	or = kzalloc(sizeof(*or), gfp);
+	/* A user-mode constructor that failed leaves no pool */
+	if (unlikely(!osd_request_pool))
+		return NULL;
+
+	or = mempool_alloc(osd_request_pool, gfp);
+	if (likely(or))
+		memset(or, 0, offsetof(struct osd_request, out_data_integ));
 	return or;
 }
 
 static void _osd_request_free(struct osd_request *or)
 {
-	kfree(or);
+	mempool_free(or, osd_request_pool);
 }
 
 struct osd_request *osd_start_request(struct osd_dev *dev, gfp_t gfp)
@@ -414,6 +426,10 @@ struct osd_request *osd_start_request(struct osd_dev *dev, gfp_t gfp)
 	if (!or)
 		return NULL;
 
+	or->cdb_cont.inline_buff = or->inline_segs[0];
+	or->set_attr.inline_buff = or->inline_segs[1];
+	or->enc_get_attr.inline_buff = or->inline_segs[2];
+	or->get_attr.inline_buff = or->inline_segs[3];
 	or->osd_dev = dev;
 	or->alloc_flags = gfp;
 	or->timeout = dev->def_timeout;
@@ -426,7 +442,7 @@ EXPORT_SYMBOL(osd_start_request);
 static void _osd_free_seg(struct osd_request *or __unused,
 	struct _osd_req_data_segment *seg)
 {
-	if (!seg->buff || !seg->alloc_size)
+	if (!seg->buff || !seg->alloc_size || (seg->buff == seg->inline_buff))
 		return;
 
 	kfree(seg->buff);
@@ -448,7 +464,7 @@ static void _put_request(struct request *rq)
 		blk_put_request(rq);
 }
 
-void osd_end_request(struct osd_request *or)
+static void _osd_put_requests(struct osd_request *or)
 {
 	struct request *rq = or->request;
 
@@ -459,7 +475,27 @@ void osd_end_request(struct osd_request *or)
 		}
 
 		_put_request(rq);
+		or->request = NULL;
+	}
+}
+
+/* The segments held by osd_req_prepare() */
+static void _osd_req_put_segs(struct bio *bio)
+{
+	while (bio) {
+		struct bio *next = bio->bi_next;
+
+		bio_put(bio);
+		bio = next;
 	}
+}
+
+void osd_end_request(struct osd_request *or)
+{
+	_osd_put_requests(or);
+	_osd_req_put_segs(or->prep_out_segs);
+	_osd_req_put_segs(or->prep_in_segs);
+	kfree(or->attr_table);
 
 	_osd_free_seg(or, &or->get_attr);
 	_osd_free_seg(or, &or->enc_get_attr);
@@ -536,7 +572,22 @@ static int _osd_realloc_seg(struct osd_request *or,
 	if (seg->alloc_size >= max_bytes)
 		return 0;
 
-	buff = krealloc(seg->buff, max_bytes, or->alloc_flags);
+	if (!seg->buff && seg->inline_buff &&
+	    (max_bytes <= OSD_REQ_INLINE_SEG_LEN)) {
+		seg->buff = seg->inline_buff;
+		seg->alloc_size = OSD_REQ_INLINE_SEG_LEN;
+		memset(seg->buff, 0, OSD_REQ_INLINE_SEG_LEN);
+		return 0;
+	}
+
+	if (seg->buff && (seg->buff == seg->inline_buff)) {
+		/* Outgrew the inline buffer */
+		buff = kmalloc(max_bytes, or->alloc_flags);
+		if (buff)
+			memcpy(buff, seg->buff, seg->alloc_size);
+	} else {
+		buff = krealloc(seg->buff, max_bytes, or->alloc_flags);
+	}
 	if (!buff) {
 		OSD_ERR("Failed to Realloc %d-bytes was-%d\n", max_bytes,
 			seg->alloc_size);
@@ -704,23 +755,73 @@ EXPORT_SYMBOL(osd_req_remove_partition);
 	osd_id partition, u8 new_key_id[OSD_CRYPTO_KEYID_SIZE],
 	u8 seed[OSD_CRYPTO_SEED_SIZE]); */
 
-static int _osd_req_list_objects(struct osd_request *or,
-	__be16 action, const struct osd_obj_id *obj, osd_id initial_id,
-	struct osd_obj_id_list *list, unsigned nelem)
+/*
+ * OSD2 snapshots and clones are of a whole partition. The source partition
+ * goes in the partition field and the requested new partition in the
+ * object field of the CDB.
+ */
+static void _osd_req_encode_partition_copy(struct osd_request *or,
+	__be16 act, osd_id partition, osd_id new_partition)
 {
-	struct request_queue *q = osd_request_queue(or->osd_dev);
-	u64 len = nelem * sizeof(osd_id) + sizeof(*list);
-	struct bio *bio;
+	struct osd_obj_id par = {
+		.partition = partition,
+		.id = new_partition,
+	};
 
-	_osd_req_encode_common(or, action, obj, (u64)initial_id, len);
+	WARN_ON(osd_req_is_ver1(or));
+	_osd_req_encode_common(or, act, &par, 0, 0);
+}
 
-	if (list->list_identifier)
-		_osd_req_encode_olist(or, list);
+void osd_req_create_snapshot(struct osd_request *or, osd_id partition,
+	osd_id snap_partition)
+{
+	_osd_req_encode_partition_copy(or, OSD_ACT_CREATE_SNAPSHOT, partition,
+				       snap_partition);
+}
+EXPORT_SYMBOL(osd_req_create_snapshot);
+
+void osd_req_create_clone(struct osd_request *or, osd_id partition,
+	osd_id clone_partition)
+{
+	_osd_req_encode_partition_copy(or, OSD_ACT_CREATE_CLONE, partition,
+				       clone_partition);
+}
+EXPORT_SYMBOL(osd_req_create_clone);
+
+void osd_req_detach_clone(struct osd_request *or, osd_id clone_partition)
+{
+	_osd_req_encode_partition_copy(or, OSD_ACT_DETACH_CLONE,
+				       clone_partition, 0);
+}
+EXPORT_SYMBOL(osd_req_detach_clone);
+
+void osd_req_refresh_snapshot_clone(struct osd_request *or,
+	osd_id partition)
+{
+	_osd_req_encode_partition_copy(or, OSD_ACT_REFRESH_SNAPSHOT_CLONE,
+				       partition, 0);
+}
+EXPORT_SYMBOL(osd_req_refresh_snapshot_clone);
+
+void osd_req_restore_partition_from_snapshot(struct osd_request *or,
+	osd_id partition, osd_id snap_partition)
+{
+	_osd_req_encode_partition_copy(or,
+		OSD_ACT_RESTORE_PARTITION_FROM_SNAPSHOT, partition,
+		snap_partition);
+}
+EXPORT_SYMBOL(osd_req_restore_partition_from_snapshot);
+
+/* Map a kernel buffer for a command's returned data-in list */
+static int _osd_req_map_data_in(struct osd_request *or, void *buff, u64 len)
+{
+	struct request_queue *q = osd_request_queue(or->osd_dev);
+	struct bio *bio;
 
 	WARN_ON(or->in.bio);
-	bio = bio_map_kern(q, list, len, or->alloc_flags);
+	bio = bio_map_kern(q, buff, len, or->alloc_flags);
 	if (IS_ERR(bio)) {
-		OSD_ERR("!!! Failed to allocate list_objects BIO\n");
+		OSD_ERR("!!! Failed to allocate data-in list BIO\n");
 		return PTR_ERR(bio);
 	}
 
@@ -730,6 +831,20 @@ static int _osd_req_list_objects(struct osd_request *or,
 	return 0;
 }
 
+static int _osd_req_list_objects(struct osd_request *or,
+	__be16 action, const struct osd_obj_id *obj, osd_id initial_id,
+	struct osd_obj_id_list *list, unsigned nelem)
+{
+	u64 len = nelem * sizeof(osd_id) + sizeof(*list);
+
+	_osd_req_encode_common(or, action, obj, (u64)initial_id, len);
+
+	if (list->list_identifier)
+		_osd_req_encode_olist(or, list);
+
+	return _osd_req_map_data_in(or, list, len);
+}
+
 int osd_req_list_partition_collections(struct osd_request *or,
 	osd_id partition, osd_id initial_id, struct osd_obj_id_list *list,
 	unsigned nelem)
@@ -769,10 +884,27 @@ EXPORT_SYMBOL(osd_req_flush_partition);
 /*
  * Collection commands
  */
-/*TODO: void osd_req_create_collection(struct osd_request *,
-	const struct osd_obj_id *); */
-/*TODO: void osd_req_remove_collection(struct osd_request *,
-	const struct osd_obj_id *); */
+void osd_req_create_collection(struct osd_request *or,
+	const struct osd_obj_id *obj)
+{
+	_osd_req_encode_common(or, OSD_ACT_CREATE_COLLECTION, obj, 0, 0);
+}
+EXPORT_SYMBOL(osd_req_create_collection);
+
+void osd_req_remove_collection(struct osd_request *or,
+	const struct osd_obj_id *obj)
+{
+	_osd_req_encode_common(or, OSD_ACT_REMOVE_COLLECTION, obj, 0, 0);
+}
+EXPORT_SYMBOL(osd_req_remove_collection);
+
+void osd_req_remove_member_objects(struct osd_request *or,
+	const struct osd_obj_id *obj)
+{
+	WARN_ON(osd_req_is_ver1(or));
+	_osd_req_encode_common(or, OSD_ACT_REMOVE_MEMBER_OBJECTS, obj, 0, 0);
+}
+EXPORT_SYMBOL(osd_req_remove_member_objects);
 
 int osd_req_list_collection_objects(struct osd_request *or,
 	const struct osd_obj_id *obj, osd_id initial_id,
@@ -783,18 +915,115 @@ int osd_req_list_collection_objects(struct osd_request *or,
 }
 EXPORT_SYMBOL(osd_req_list_collection_objects);
 
-/*TODO: void query(struct osd_request *, ...); V2 */
+static int _add_query_continuation_descriptor(struct osd_request *or,
+	enum osd_query_type type, const struct osd_query_criterion *criteria,
+	unsigned ncriteria)
+{
+	struct osd_continuation_descriptor_header *hdr;
+	struct osd_query_list_header *qlh;
+	u32 payload, pad;
+	unsigned i;
+	u8 *p;
+	int ret;
+
+	payload = sizeof(*qlh);
+	for (i = 0; i < ncriteria; i++)
+		payload += sizeof(struct osd_query_criterion_entry) +
+			   criteria[i].min_len + sizeof(__be16) +
+			   criteria[i].max_len;
+	pad = ALIGN(payload, 8) - payload;
+
+	if (!or->cdb_cont.total_bytes)
+		or->cdb_cont.total_bytes =
+				sizeof(struct osd_continuation_segment_header);
+
+	ret = _alloc_cdb_cont(or, or->cdb_cont.total_bytes + sizeof(*hdr) +
+			      payload + pad);
+	if (unlikely(ret))
+		return ret;
+
+	hdr = or->cdb_cont.buff + or->cdb_cont.total_bytes;
+	hdr->type = cpu_to_be16(QUERY_LIST);
+	hdr->pad_length = pad;
+	hdr->length = cpu_to_be32(payload);
+
+	qlh = (void *)(hdr + 1);
+	qlh->query_type = type;
+	p = (u8 *)(qlh + 1);
+
+	for (i = 0; i < ncriteria; i++) {
+		const struct osd_query_criterion *qc = &criteria[i];
+		struct osd_query_criterion_entry *qce = (void *)p;
+
+		qce->query_entry_length = cpu_to_be16(sizeof(*qce) -
+			offsetof(struct osd_query_criterion_entry, attr_page) +
+			qc->min_len + sizeof(__be16) + qc->max_len);
+		qce->attr_page = cpu_to_be32(qc->attr_page);
+		qce->attr_id = cpu_to_be32(qc->attr_id);
+		qce->min_len = cpu_to_be16(qc->min_len);
+		p += sizeof(*qce);
+		memcpy(p, qc->min_val, qc->min_len);
+		p += qc->min_len;
+		put_unaligned_be16(qc->max_len, p);
+		p += sizeof(__be16);
+		memcpy(p, qc->max_val, qc->max_len);
+		p += qc->max_len;
+	}
+
+	or->cdb_cont.total_bytes += sizeof(*hdr) + payload + pad;
+	return 0;
+}
+
+/* osd_req_query: Find member objects of a collection by attribute values.
+ * The matched object ids are returned into @matches, with room for @nelem.
+ */
+int osd_req_query(struct osd_request *or, const struct osd_obj_id *obj,
+	enum osd_query_type type, const struct osd_query_criterion *criteria,
+	unsigned ncriteria, struct osd_query_matches_list *matches,
+	unsigned nelem)
+{
+	u64 len = nelem * sizeof(matches->object_ids[0]) + sizeof(*matches);
+	int ret;
+
+	if (unlikely(osd_req_is_ver1(or) || !ncriteria))
+		return -EINVAL;
+
+	ret = _add_query_continuation_descriptor(or, type, criteria,
+						 ncriteria);
+	if (unlikely(ret))
+		return ret;
+
+	_osd_req_encode_common(or, OSD_ACT_QUERY, obj, 0, len);
+
+	return _osd_req_map_data_in(or, matches, len);
+}
+EXPORT_SYMBOL(osd_req_query);
 
 void osd_req_flush_collection(struct osd_request *or,
 	const struct osd_obj_id *obj, enum osd_options_flush_scope_values op)
 {
-	_osd_req_encode_common(or, OSD_ACT_FLUSH_PARTITION, obj, 0, 0);
+	_osd_req_encode_common(or, OSD_ACT_FLUSH_COLLECTION, obj, 0, 0);
 	_osd_req_encode_flush(or, op);
 }
 EXPORT_SYMBOL(osd_req_flush_collection);
 
-/*TODO: void get_member_attrs(struct osd_request *, ...); V2 */
-/*TODO: void set_member_attrs(struct osd_request *, ...); V2 */
+void osd_req_get_member_attrs(struct osd_request *or,
+	const struct osd_obj_id *obj, unsigned max_members)
+{
+	WARN_ON(osd_req_is_ver1(or));
+	_osd_req_encode_common(or, OSD_ACT_GET_MEMBER_ATTRIBUTES, obj, 0, 0);
+	/* get_attr is sized at finalize, once the attributes are known */
+	or->member_attrs_max = max_members ? max_members : 1;
+}
+EXPORT_SYMBOL(osd_req_get_member_attrs);
+
+void osd_req_set_member_attrs(struct osd_request *or,
+	const struct osd_obj_id *obj)
+{
+	WARN_ON(osd_req_is_ver1(or));
+	_osd_req_encode_common(or, OSD_ACT_SET_MEMBER_ATTRIBUTES, obj, 0, 0);
+}
+EXPORT_SYMBOL(osd_req_set_member_attrs);
 
 /*
  * Object commands
@@ -811,25 +1040,58 @@ void osd_req_remove_object(struct osd_request *or, struct osd_obj_id *obj)
 }
 EXPORT_SYMBOL(osd_req_remove_object);
 
+int osd_req_create_objects(struct osd_request *or, osd_id partition,
+	unsigned count)
+{
+	struct osd_obj_id par = {
+		.partition = partition,
+		.id = 0, /* target assigned */
+	};
+	struct osd_attr created_id = ATTR_DEF(OSD_APAGE_CURRENT_COMMAND,
+			OSD_ATTR_CC_OBJECT_ID, sizeof(__be64));
+
+	if (unlikely(!count || count > 0xffff))
+		return -EINVAL;
 
-/*TODO: void osd_req_create_multi(struct osd_request *or,
-	struct osd_obj_id *first, struct osd_obj_id_list *list, unsigned nelem);
-*/
+	_osd_req_encode_common(or, OSD_ACT_CREATE, &par, 0, 0);
+	put_unaligned_be16(count, (u8 *)osd_cdb_head(&or->cdb) +
+				  OSD_CDB_CREATE_NUM_OBJECTS_OFFSET);
 
-void osd_req_write(struct osd_request *or,
-	const struct osd_obj_id *obj, u64 offset,
-	struct bio *bio, u64 len)
+	return osd_req_add_get_attr_list(or, &created_id, 1);
+}
+EXPORT_SYMBOL(osd_req_create_objects);
+
+int osd_req_decode_created_objects(struct osd_request *or, osd_id *first_id)
 {
-	_osd_req_encode_common(or, OSD_ACT_WRITE, obj, offset, len);
+	struct osd_attr created_id = {
+		.attr_page = OSD_APAGE_CURRENT_COMMAND,
+		.attr_id = OSD_ATTR_CC_OBJECT_ID,
+	};
+	int ret = osd_req_find_get_attr(or, &created_id);
+
+	if (unlikely(ret))
+		return ret;
+
+	if (unlikely(created_id.len != sizeof(__be64)))
+		return -EIO;
+
+	*first_id = get_unaligned_be64(created_id.val_ptr);
+	return 0;
+}
+EXPORT_SYMBOL(osd_req_decode_created_objects);
+
+static void _osd_req_encode_write(struct osd_request *or, __be16 act,
+	const struct osd_obj_id *obj, u64 offset, struct bio *bio, u64 len)
+{
+	_osd_req_encode_common(or, act, obj, offset, len);
 	WARN_ON(or->out.bio || or->out.total_bytes);
 	WARN_ON(0 == (bio->bi_rw & REQ_WRITE));
 	or->out.bio = bio;
 	or->out.total_bytes = len;
 }
-EXPORT_SYMBOL(osd_req_write);
 
-int osd_req_write_kern(struct osd_request *or,
-	const struct osd_obj_id *obj, u64 offset, void* buff, u64 len)
+static int _osd_req_encode_write_kern(struct osd_request *or, __be16 act,
+	const struct osd_obj_id *obj, u64 offset, void *buff, u64 len)
 {
 	struct request_queue *req_q = osd_request_queue(or->osd_dev);
 	struct bio *bio = bio_map_kern(req_q, buff, len, GFP_KERNEL);
@@ -838,19 +1100,161 @@ int osd_req_write_kern(struct osd_request *or,
 		return PTR_ERR(bio);
 
 	bio->bi_rw |= REQ_WRITE; /* FIXME: bio_set_dir() */
-	osd_req_write(or, obj, offset, bio, len);
+	_osd_req_encode_write(or, act, obj, offset, bio, len);
 	return 0;
 }
+
+void osd_req_write(struct osd_request *or,
+	const struct osd_obj_id *obj, u64 offset,
+	struct bio *bio, u64 len)
+{
+	_osd_req_encode_write(or, OSD_ACT_WRITE, obj, offset, bio, len);
+}
+EXPORT_SYMBOL(osd_req_write);
+
+int osd_req_write_kern(struct osd_request *or,
+	const struct osd_obj_id *obj, u64 offset, void* buff, u64 len)
+{
+	return _osd_req_encode_write_kern(or, OSD_ACT_WRITE, obj, offset,
+					  buff, len);
+}
 EXPORT_SYMBOL(osd_req_write_kern);
 
-/*TODO: void osd_req_append(struct osd_request *,
-	const struct osd_obj_id *, struct bio *data_out); */
-/*TODO: void osd_req_create_write(struct osd_request *,
-	const struct osd_obj_id *, struct bio *data_out, u64 offset); */
-/*TODO: void osd_req_clear(struct osd_request *,
-	const struct osd_obj_id *, u64 offset, u64 len); */
-/*TODO: void osd_req_punch(struct osd_request *,
-	const struct osd_obj_id *, u64 offset, u64 len); V2 */
+void osd_req_create_and_write(struct osd_request *or,
+	const struct osd_obj_id *obj, u64 offset,
+	struct bio *bio, u64 len)
+{
+	_osd_req_encode_write(or, OSD_ACT_CREATE_AND_WRITE, obj, offset, bio,
+			      len);
+}
+EXPORT_SYMBOL(osd_req_create_and_write);
+
+int osd_req_create_and_write_kern(struct osd_request *or,
+	const struct osd_obj_id *obj, u64 offset, void *buff, u64 len)
+{
+	return _osd_req_encode_write_kern(or, OSD_ACT_CREATE_AND_WRITE, obj,
+					  offset, buff, len);
+}
+EXPORT_SYMBOL(osd_req_create_and_write_kern);
+
+static int _osd_req_add_append_attr(struct osd_request *or)
+{
+	struct osd_attr append_at = ATTR_DEF(OSD_APAGE_CURRENT_COMMAND,
+			OSD_ATTR_CC_STARTING_BYTE_ADDRESS_OF_APPEND,
+			sizeof(__be64));
+
+	return osd_req_add_get_attr_list(or, &append_at, 1);
+}
+
+int osd_req_append(struct osd_request *or,
+	const struct osd_obj_id *obj, struct bio *bio, u64 len)
+{
+	/* The target picks the offset, the CDB's starting address is
+	 * reserved for APPEND.
+	 */
+	_osd_req_encode_write(or, OSD_ACT_APPEND, obj, 0, bio, len);
+	return _osd_req_add_append_attr(or);
+}
+EXPORT_SYMBOL(osd_req_append);
+
+int osd_req_append_kern(struct osd_request *or,
+	const struct osd_obj_id *obj, void *buff, u64 len)
+{
+	int ret = _osd_req_encode_write_kern(or, OSD_ACT_APPEND, obj, 0,
+					     buff, len);
+
+	if (unlikely(ret))
+		return ret;
+
+	return _osd_req_add_append_attr(or);
+}
+EXPORT_SYMBOL(osd_req_append_kern);
+
+int osd_req_decode_append_offset(struct osd_request *or, u64 *offset)
+{
+	struct osd_attr append_at = {
+		.attr_page = OSD_APAGE_CURRENT_COMMAND,
+		.attr_id = OSD_ATTR_CC_STARTING_BYTE_ADDRESS_OF_APPEND,
+	};
+	int ret = osd_req_find_get_attr(or, &append_at);
+
+	if (unlikely(ret))
+		return ret;
+
+	if (unlikely(append_at.len != sizeof(__be64)))
+		return -EIO;
+
+	*offset = get_unaligned_be64(append_at.val_ptr);
+	return 0;
+}
+EXPORT_SYMBOL(osd_req_decode_append_offset);
+
+void osd_req_clear(struct osd_request *or,
+	const struct osd_obj_id *obj, u64 offset, u64 len)
+{
+	WARN_ON(osd_req_is_ver1(or));
+	_osd_req_encode_common(or, OSD_ACT_CLEAR, obj, offset, len);
+}
+EXPORT_SYMBOL(osd_req_clear);
+
+void osd_req_punch(struct osd_request *or,
+	const struct osd_obj_id *obj, u64 offset, u64 len)
+{
+	WARN_ON(osd_req_is_ver1(or));
+	_osd_req_encode_common(or, OSD_ACT_PUNCH, obj, offset, len);
+}
+EXPORT_SYMBOL(osd_req_punch);
+
+int osd_req_read_map(struct osd_request *or, const struct osd_obj_id *obj,
+	u64 offset, enum osd_map_type type, struct osd_map_list *list,
+	unsigned nelem)
+{
+	u64 len = nelem * sizeof(list->maps[0]) + sizeof(*list);
+
+	if (unlikely(osd_req_is_ver1(or)))
+		return -EINVAL;
+
+	_osd_req_encode_common(or, OSD_ACT_READ_MAP, obj, offset, len);
+	put_unaligned_be16(type, (u8 *)osd_cdb_head(&or->cdb) +
+				 OSD_CDB_READ_MAP_TYPE_OFFSET);
+
+	return _osd_req_map_data_in(or, list, len);
+}
+EXPORT_SYMBOL(osd_req_read_map);
+
+int osd_req_read_maps_compare(struct osd_request *or,
+	const struct osd_obj_id *obj, const struct osd_obj_id *other,
+	u64 offset, struct osd_map_list *list, unsigned nelem)
+{
+	u64 len = nelem * sizeof(list->maps[0]) + sizeof(*list);
+	struct osd_user_object_continuation_descriptor *uocd;
+	int ret;
+
+	if (unlikely(osd_req_is_ver1(or)))
+		return -EINVAL;
+
+	if (!or->cdb_cont.total_bytes)
+		or->cdb_cont.total_bytes =
+				sizeof(struct osd_continuation_segment_header);
+
+	ret = _alloc_cdb_cont(or, or->cdb_cont.total_bytes + sizeof(*uocd));
+	if (unlikely(ret))
+		return ret;
+
+	uocd = or->cdb_cont.buff + or->cdb_cont.total_bytes;
+	uocd->hdr.type = cpu_to_be16(USER_OBJECT);
+	uocd->hdr.pad_length = 0;
+	uocd->hdr.length = cpu_to_be32(sizeof(*uocd) - sizeof(uocd->hdr));
+	uocd->partition_id = cpu_to_be64(other->partition);
+	uocd->user_object_id = cpu_to_be64(other->id);
+	or->cdb_cont.total_bytes += sizeof(*uocd);
+
+	_osd_req_encode_common(or, OSD_ACT_READ_MAPS_COMPARE, obj, offset,
+			       len);
+
+	return _osd_req_map_data_in(or, list, len);
+}
+EXPORT_SYMBOL(osd_req_read_maps_compare);
 
 void osd_req_flush_object(struct osd_request *or,
 	const struct osd_obj_id *obj, enum osd_options_flush_scope_values op,
@@ -940,6 +1344,7 @@ static int _osd_req_finalize_cdb_cont(struct osd_request *or, const u8 *cap_key)
 	struct bio *bio;
 	struct osd_cdb_head *cdbh = osd_cdb_head(&or->cdb);
 	struct osd_continuation_segment_header *cont_seg_hdr;
+	int ret;
 
 	if (!or->cdb_cont.total_bytes)
 		return 0;
@@ -960,7 +1365,16 @@ static int _osd_req_finalize_cdb_cont(struct osd_request *or, const u8 *cap_key)
 	 * with the other data segments since the continuation
 	 * integrity is separate from the other data segments.
 	 */
-	osd_sec_sign_data(cont_seg_hdr->integrity_check, bio, cap_key);
+	if (osd_sec_method(&or->cdb) != OSD_SEC_NOSEC) {
+		memset(cont_seg_hdr->integrity_check, 0,
+		       sizeof(cont_seg_hdr->integrity_check));
+		ret = osd_sec_sign_data(cont_seg_hdr->integrity_check, bio,
+					or->cdb_cont.total_bytes, cap_key);
+		if (unlikely(ret)) {
+			bio_put(bio);
+			return ret;
+		}
+	}
 
 	cdbh->v2.cdb_continuation_length = cpu_to_be32(or->cdb_cont.total_bytes);
 
@@ -1297,6 +1711,16 @@ static int _osd_req_finalize_get_attr_list(struct osd_request *or)
 		return 0;
 	}
 
+	if (or->member_attrs_max) {
+		/* Room for a multi-object list, of the attributes per member */
+		unsigned hdr = _osd_req_sizeof_alist_header(or);
+
+		or->get_attr.total_bytes = hdr + or->member_attrs_max *
+			(sizeof(struct osd_attributes_list_multi_header) +
+			 or->get_attr.total_bytes - hdr);
+		or->member_attrs_max = 0;
+	}
+
 	ret = _alloc_get_attr_list(or);
 	if (ret)
 		return ret;
@@ -1399,6 +1823,155 @@ int osd_req_decode_get_attr_list(struct osd_request *or,
 }
 EXPORT_SYMBOL(osd_req_decode_get_attr_list);
 
+/*
+ * Returned attributes are decoded once, into an open addressing hash of
+ * (page, id) => (val_ptr, len). An empty slot has a NULL val_ptr.
+ */
+static inline unsigned _attr_hash(u32 attr_page, u32 attr_id)
+{
+	return (attr_page * 0x9E3779B1U) ^ (attr_id * 0x85EBCA77U);
+}
+
+static int _osd_req_build_attr_table(struct osd_request *or)
+{
+	struct osd_attr oas[16];
+	unsigned count = 0, size, i;
+	void *iter = NULL;
+	int nelem;
+
+	do {
+		nelem = ARRAY_SIZE(oas);
+		osd_req_decode_get_attr_list(or, oas, &nelem, &iter);
+		count += nelem;
+	} while (iter);
+
+	for (size = 8; size < 2 * count; size <<= 1)
+		;
+
+	or->attr_table = kzalloc(size * sizeof(*or->attr_table),
+				 or->alloc_flags);
+	if (unlikely(!or->attr_table))
+		return -ENOMEM;
+	or->attr_table_size = size;
+
+	do {
+		nelem = ARRAY_SIZE(oas);
+		osd_req_decode_get_attr_list(or, oas, &nelem, &iter);
+		for (i = 0; i < (unsigned)nelem; i++) {
+			unsigned h = _attr_hash(oas[i].attr_page,
+						oas[i].attr_id) & (size - 1);
+
+			if (unlikely(!oas[i].val_ptr))
+				break; /* BAD FOOD */
+
+			while (or->attr_table[h].val_ptr) {
+				if ((or->attr_table[h].attr_page ==
+				     oas[i].attr_page) &&
+				    (or->attr_table[h].attr_id ==
+				     oas[i].attr_id))
+					break; /* first one wins */
+				h = (h + 1) & (size - 1);
+			}
+			if (!or->attr_table[h].val_ptr)
+				or->attr_table[h] = oas[i];
+		}
+	} while (iter);
+
+	return 0;
+}
+
+int osd_req_find_get_attr(struct osd_request *or, struct osd_attr *oa)
+{
+	unsigned h;
+
+	if (!or->attr_table) {
+		int ret = _osd_req_build_attr_table(or);
+
+		if (unlikely(ret))
+			return ret;
+	}
+
+	h = _attr_hash(oa->attr_page, oa->attr_id);
+	for (;; ++h) {
+		struct osd_attr *cur =
+			&or->attr_table[h & (or->attr_table_size - 1)];
+
+		if (!cur->val_ptr)
+			return -ENOENT;
+
+		if ((cur->attr_page == oa->attr_page) &&
+		    (cur->attr_id == oa->attr_id)) {
+			oa->len = cur->len;
+			oa->val_ptr = cur->val_ptr;
+			return 0;
+		}
+	}
+}
+EXPORT_SYMBOL(osd_req_find_get_attr);
+
+int osd_req_decode_member_attrs(struct osd_request *or, osd_id *member_id,
+	struct osd_attr *oa, int *nelem, void **iterator)
+{
+	const unsigned sizeof_attr_list = _osd_req_sizeof_alist_header(or);
+	struct osd_attributes_list_multi_header *mh;
+	void *list_end, *cur_p, *elem_p, *elem_end;
+	unsigned returned_bytes;
+	int n;
+
+	if (!_osd_req_is_alist_type(or, or->get_attr.buff,
+				    OSD_V2_ATTR_LIST_MULTIPLE)) {
+		*nelem = 0;
+		*iterator = NULL;
+		return 0;
+	}
+
+	returned_bytes = _osd_req_alist_size(or, or->get_attr.buff) +
+				sizeof_attr_list;
+	if (returned_bytes > or->get_attr.alloc_size) {
+		OSD_DEBUG("target report: space was not big enough! "
+			  "Allocate=%u Needed=%u\n",
+			  or->get_attr.alloc_size, returned_bytes);
+		returned_bytes = or->get_attr.alloc_size;
+	}
+	list_end = or->get_attr.buff + returned_bytes;
+
+	cur_p = *iterator ? *iterator : or->get_attr.buff + sizeof_attr_list;
+	BUG_ON((cur_p < or->get_attr.buff) || (list_end < cur_p));
+
+	if (cur_p + sizeof(*mh) > list_end) {
+		*nelem = 0;
+		*iterator = NULL;
+		return 0;
+	}
+
+	mh = cur_p;
+	*member_id = be64_to_cpu(mh->object_id);
+	elem_p = cur_p + sizeof(*mh);
+	elem_end = elem_p + be16_to_cpu(mh->list_bytes);
+	if (elem_end > list_end)
+		elem_end = list_end;
+
+	for (n = 0; (n < *nelem) && (elem_p < elem_end); ++n) {
+		int inc = _osd_req_alist_elem_decode(or, elem_p, oa,
+						     elem_end - elem_p);
+
+		if (inc < 0) {
+			OSD_ERR("BAD FOOD from target. member list not valid!"
+				"member=0x%llx n=%d\n", _LLU(*member_id), n);
+			oa->val_ptr = NULL;
+			elem_end = list_end; /* break the caller loop */
+			break;
+		}
+
+		elem_p += inc;
+		++oa;
+	}
+
+	*iterator = (elem_end < list_end) ? elem_end : NULL;
+	*nelem = n;
+	return list_end - elem_end;
+}
+EXPORT_SYMBOL(osd_req_decode_member_attrs);
 /*
  * Attributes Page-mode
  */
@@ -1481,13 +2054,12 @@ static inline void osd_sec_parms_set_in_offset(bool is_v1,
 }
 
 static int _osd_req_finalize_data_integrity(struct osd_request *or,
-	bool has_in, bool has_out, struct bio *out_data_bio, u64 out_data_bytes,
-	const u8 *cap_key)
+	bool has_in, bool has_out, u64 out_data_bytes, const u8 *cap_key)
 {
 	struct osd_security_parameters *sec_parms = _osd_req_sec_params(or);
 	int ret;
 
-	if (!osd_is_sec_alldata(sec_parms))
+	if (!osd_is_sec_alldata(&or->cdb))
 		return 0;
 
 	if (has_out) {
@@ -1495,6 +2067,8 @@ static int _osd_req_finalize_data_integrity(struct osd_request *or,
 			.buff = &or->out_data_integ,
 			.total_bytes = sizeof(or->out_data_integ),
 		};
+		u8 *icv = or->out_data_integ.integrity_check_value;
+		struct bio *bio;
 		unsigned pad;
 
 		or->out_data_integ.data_bytes = cpu_to_be64(out_data_bytes);
@@ -1502,6 +2076,7 @@ static int _osd_req_finalize_data_integrity(struct osd_request *or,
 			or->set_attr.total_bytes);
 		or->out_data_integ.get_attributes_bytes = cpu_to_be64(
 			or->enc_get_attr.total_bytes);
+		memset(icv, 0, sizeof(or->out_data_integ.integrity_check_value));
 
 		osd_sec_parms_set_out_offset(osd_req_is_ver1(or), sec_parms,
 			osd_req_encode_offset(or, or->out.total_bytes, &pad));
@@ -1512,9 +2087,18 @@ static int _osd_req_finalize_data_integrity(struct osd_request *or,
 			return ret;
 		or->out.last_seg = NULL;
 
-		/* they are now all chained to request sign them all together */
-		osd_sec_sign_data(&or->out_data_integ, out_data_bio,
-				  cap_key);
+		/* they are now all chained to request sign them all together,
+		 * from after the continuation up to the integrity check value
+		 */
+		bio = or->out.req->bio;
+		if (or->cdb_cont.total_bytes)
+			bio = bio->bi_next;
+		ret = osd_sec_sign_data(icv, bio, or->out.total_bytes -
+			or->cdb_cont.total_bytes -
+			sizeof(or->out_data_integ.integrity_check_value),
+			cap_key);
+		if (ret)
+			return ret;
 	}
 
 	if (has_in) {
@@ -1604,13 +2188,12 @@ out:
 	return ret;
 }
 
-int osd_finalize_request(struct osd_request *or,
-	u8 options, const void *cap, const u8 *cap_key)
+static int _osd_finalize_request(struct osd_request *or,
+	u8 options, const u8 *cap_key)
 {
 	struct osd_cdb_head *cdbh = osd_cdb_head(&or->cdb);
 	bool has_in, has_out;
 	 /* Save for data_integrity without the cdb_continuation */
-	struct bio *out_data_bio = or->out.bio;
 	u64 out_data_bytes = or->out.total_bytes;
 	int ret;
 
@@ -1623,8 +2206,6 @@ int osd_finalize_request(struct osd_request *or,
 	if (options & OSD_REQ_BYPASS_TIMESTAMPS)
 		cdbh->timestamp_control = OSD_CDB_BYPASS_TIMESTAMPS;
 
-	osd_set_caps(&or->cdb, cap);
-
 	has_in = or->in.bio || or->get_attr.total_bytes;
 	has_out = or->out.bio || or->cdb_cont.total_bytes ||
 		or->set_attr.total_bytes || or->enc_get_attr.total_bytes;
@@ -1671,20 +2252,255 @@ int osd_finalize_request(struct osd_request *or,
 	}
 
 	ret = _osd_req_finalize_data_integrity(or, has_in, has_out,
-					       out_data_bio, out_data_bytes,
-					       cap_key);
+					       out_data_bytes, cap_key);
 	if (ret)
 		return ret;
 
-	osd_sec_sign_cdb(&or->cdb, cap_key);
+	ret = osd_sec_sign_cdb(&or->cdb, cap_key, osd_req_is_ver1(or));
+	if (ret)
+		return ret;
 
 	or->request->cmd = or->cdb.buff;
 	or->request->cmd_len = _osd_req_cdb_len(or);
 
 	return 0;
 }
+
+int osd_finalize_request(struct osd_request *or,
+	u8 options, const void *cap, const u8 *cap_key)
+{
+	osd_set_caps(&or->cdb, cap);
+	return _osd_finalize_request(or, options, cap_key);
+}
 EXPORT_SYMBOL(osd_finalize_request);
 
+/*
+ * Prepared requests
+ */
+/* Hold the mapped segments past the completion of the request */
+static struct bio *_osd_req_hold_segs(struct bio *segs)
+{
+	struct bio *bio;
+
+	for (bio = segs; bio; bio = bio->bi_next)
+		bio_get(bio);
+	return segs;
+}
+
+int osd_req_prepare(struct osd_request *or,
+	u8 options, const void *cap, const u8 *cap_key)
+{
+	struct _osd_io_info *io;
+	struct bio *last;
+	int ret;
+
+	/* sg commands keep their offsets in the cdb continuation */
+	if (unlikely(or->prepared || or->cdb_cont.total_bytes ||
+		     (or->in.bio && or->out.bio)))
+		return -EINVAL;
+
+	or->prep_write = (or->out.bio != NULL);
+	io = or->prep_write ? &or->out : &or->in;
+	or->prep_data_len = io->total_bytes;
+	/* The segments are mapped after the last data bio */
+	for (last = io->bio; last && last->bi_next; last = last->bi_next)
+		;
+
+	osd_set_caps(&or->cdb, cap);
+	ret = _osd_finalize_request(or, options, cap_key);
+	if (ret)
+		return ret;
+
+	if (cap_key) {
+		memcpy(or->prep_cap_key, cap_key, OSD_SEC_CAP_KEY_LEN);
+		or->prep_has_key = true;
+	}
+	/* as sized by finalize, before decoding the returned list */
+	or->prep_get_attr_bytes = or->get_attr.total_bytes;
+
+	if (or->prep_write) {
+		or->prep_out_segs = _osd_req_hold_segs(last->bi_next);
+		if (or->in.req)
+			or->prep_in_segs = _osd_req_hold_segs(or->in.req->bio);
+	} else {
+		or->prep_in_segs = _osd_req_hold_segs(last ? last->bi_next :
+			or->in.req ? or->in.req->bio : NULL);
+		if (or->out.req)
+			or->prep_out_segs = _osd_req_hold_segs(or->out.req->bio);
+	}
+	or->prepared = true;
+	return 0;
+}
+EXPORT_SYMBOL(osd_req_prepare);
+
+/* Fill the hole between shorter data and the segments */
+static int _osd_req_map_gap(struct osd_request *or, struct _osd_io_info *io,
+	u64 gap)
+{
+	struct request_queue *q = io->req->q;
+	unsigned pad_len = sizeof(sg_out_pad_buffer);
+	struct bio *bio;
+	int ret;
+
+	bio = bio_kmalloc(or->alloc_flags, (gap + pad_len - 1) / pad_len);
+	if (unlikely(!bio))
+		return -ENOMEM;
+
+	while (gap) {
+		unsigned len = gap < pad_len ? gap : pad_len;
+
+		bio_add_pc_page(q, bio, virt_to_page(io->pad_buff), len,
+				offset_in_page(io->pad_buff));
+		gap -= len;
+	}
+
+	ret = blk_rq_append_bio(q, io->req, bio);
+	if (unlikely(ret))
+		bio_put(bio);
+	return ret;
+}
+
+static int _osd_req_append_segs(struct _osd_io_info *io, struct bio *segs)
+{
+	struct request_queue *q = io->req->q;
+	struct bio *bio, *next;
+	int ret;
+
+	/* re-appended one by one, which links them back in the same order */
+	for (bio = segs; bio; bio = next) {
+		next = bio->bi_next;
+		bio->bi_next = NULL;
+		bio_get(bio);
+		ret = blk_rq_append_bio(q, io->req, bio);
+		if (unlikely(ret)) {
+			bio_put(bio);
+			bio->bi_next = next;
+			return ret;
+		}
+	}
+	return 0;
+}
+
+static int _osd_req_rebind_check(struct osd_request *or, u64 len)
+{
+	struct bio *segs = or->prep_write ? or->prep_out_segs :
+					    or->prep_in_segs;
+
+	if (unlikely(!or->prepared))
+		return -EINVAL;
+
+	/* The prepared CDB points at the segments right after the data */
+	if (unlikely(segs && len > or->prep_data_len))
+		return -EINVAL;
+	return 0;
+}
+
+int osd_req_rebind(struct osd_request *or, u64 offset, struct bio *bio,
+	u64 len)
+{
+	struct osd_cdb_head *cdbh = osd_cdb_head(&or->cdb);
+	const u8 *cap_key = or->prep_has_key ? or->prep_cap_key : NULL;
+	struct _osd_io_info *io;
+	struct bio *segs;
+	int ret;
+
+	ret = _osd_req_rebind_check(or, len);
+	if (ret)
+		return ret;
+
+	io = or->prep_write ? &or->out : &or->in;
+	segs = or->prep_write ? or->prep_out_segs : or->prep_in_segs;
+
+	_osd_put_requests(or);
+	kfree(or->attr_table);
+	or->attr_table = NULL;
+	or->out.req = or->in.req = NULL;
+	or->out.residual = or->in.residual = 0;
+	or->sense_len = 0;
+	or->async_error = 0;
+	or->req_errors = 0;
+	or->get_attr.total_bytes = or->prep_get_attr_bytes;
+
+	if (bio)
+		WARN_ON(or->prep_write != !!(bio->bi_rw & REQ_WRITE));
+	io->bio = bio;
+	if (!segs)
+		io->total_bytes = len;
+
+	ret = _init_blk_request(or, or->in.bio || or->prep_in_segs,
+				or->out.bio || or->prep_out_segs);
+	if (ret)
+		return ret;
+
+	if (segs && len < or->prep_data_len) {
+		ret = _osd_req_map_gap(or, io, or->prep_data_len - len);
+		if (ret)
+			return ret;
+	}
+	if (or->prep_out_segs) {
+		ret = _osd_req_append_segs(&or->out, or->prep_out_segs);
+		if (ret)
+			return ret;
+	}
+	if (or->prep_in_segs) {
+		ret = _osd_req_append_segs(&or->in, or->prep_in_segs);
+		if (ret)
+			return ret;
+	}
+
+	if (osd_req_is_ver1(or)) {
+		cdbh->v1.length = cpu_to_be64(len);
+		cdbh->v1.start_address = cpu_to_be64(offset);
+	} else {
+		cdbh->v2.length = cpu_to_be64(len);
+		cdbh->v2.start_address = cpu_to_be64(offset);
+	}
+
+	if (osd_is_sec_alldata(&or->cdb) && or->out.req) {
+		u8 *icv = or->out_data_integ.integrity_check_value;
+
+		or->out_data_integ.data_bytes = cpu_to_be64(
+			or->prep_write ? len : 0);
+		memset(icv, 0, sizeof(or->out_data_integ.integrity_check_value));
+		ret = osd_sec_sign_data(icv, or->out.req->bio,
+			or->out.total_bytes -
+			sizeof(or->out_data_integ.integrity_check_value),
+			cap_key);
+		if (ret)
+			return ret;
+	}
+
+	ret = osd_sec_sign_cdb(&or->cdb, cap_key, osd_req_is_ver1(or));
+	if (ret)
+		return ret;
+
+	or->request->cmd = or->cdb.buff;
+	or->request->cmd_len = _osd_req_cdb_len(or);
+	return 0;
+}
+EXPORT_SYMBOL(osd_req_rebind);
+
+int osd_req_rebind_kern(struct osd_request *or, u64 offset, void *buff,
+	u64 len)
+{
+	struct request_queue *req_q = osd_request_queue(or->osd_dev);
+	struct bio *bio;
+	int ret;
+
+	ret = _osd_req_rebind_check(or, len);
+	if (ret)
+		return ret;
+
+	bio = bio_map_kern(req_q, buff, len, GFP_KERNEL);
+	if (IS_ERR(bio))
+		return PTR_ERR(bio);
+
+	if (or->prep_write)
+		bio->bi_rw |= REQ_WRITE; /* FIXME: bio_set_dir() */
+	return osd_req_rebind(or, offset, bio, len);
+}
+EXPORT_SYMBOL(osd_req_rebind_kern);
+
 static bool _is_osd_security_code(int code)
 {
 	return	(code == osd_security_audit_value_frozen) ||
@@ -1930,87 +2746,6 @@ analyze:
 }
 EXPORT_SYMBOL(osd_req_decode_sense_full);
 
-/*
- * Implementation of osd_sec.h API
- * TODO: Move to a separate osd_sec.c file at a later stage.
- */
-
-enum { OSD_SEC_CAP_V1_ALL_CAPS =
-	OSD_SEC_CAP_APPEND | OSD_SEC_CAP_OBJ_MGMT | OSD_SEC_CAP_REMOVE   |
-	OSD_SEC_CAP_CREATE | OSD_SEC_CAP_SET_ATTR | OSD_SEC_CAP_GET_ATTR |
-	OSD_SEC_CAP_WRITE  | OSD_SEC_CAP_READ     | OSD_SEC_CAP_POL_SEC  |
-	OSD_SEC_CAP_GLOBAL | OSD_SEC_CAP_DEV_MGMT
-};
-
-enum { OSD_SEC_CAP_V2_ALL_CAPS =
-	OSD_SEC_CAP_V1_ALL_CAPS | OSD_SEC_CAP_QUERY | OSD_SEC_CAP_M_OBJECT
-};
-
-void osd_sec_init_nosec_doall_caps(void *caps,
-	const struct osd_obj_id *obj, bool is_collection, const bool is_v1)
-{
-	struct osd_capability *cap = caps;
-	u8 type;
-	u8 descriptor_type;
-
-	if (likely(obj->id)) {
-		if (unlikely(is_collection)) {
-			type = OSD_SEC_OBJ_COLLECTION;
-			descriptor_type = is_v1 ? OSD_SEC_OBJ_DESC_OBJ :
-						  OSD_SEC_OBJ_DESC_COL;
-		} else {
-			type = OSD_SEC_OBJ_USER;
-			descriptor_type = OSD_SEC_OBJ_DESC_OBJ;
-		}
-		WARN_ON(!obj->partition);
-	} else {
-		type = obj->partition ? OSD_SEC_OBJ_PARTITION :
-					OSD_SEC_OBJ_ROOT;
-		descriptor_type = OSD_SEC_OBJ_DESC_PAR;
-	}
-
-	memset(cap, 0, sizeof(*cap));
-
-	cap->h.format = OSD_SEC_CAP_FORMAT_VER1;
-	cap->h.integrity_algorithm__key_version = 0; /* MAKE_BYTE(0, 0); */
-	cap->h.security_method = OSD_SEC_NOSEC;
-/*	cap->expiration_time;
-	cap->AUDIT[30-10];
-	cap->discriminator[42-30];
-	cap->object_created_time; */
-	cap->h.object_type = type;
-	osd_sec_set_caps(&cap->h, OSD_SEC_CAP_V1_ALL_CAPS);
-	cap->h.object_descriptor_type = descriptor_type;
-	cap->od.obj_desc.policy_access_tag = 0;
-	cap->od.obj_desc.allowed_partition_id = cpu_to_be64(obj->partition);
-	cap->od.obj_desc.allowed_object_id = cpu_to_be64(obj->id);
-}
-EXPORT_SYMBOL(osd_sec_init_nosec_doall_caps);
-
-/* FIXME: Extract version from caps pointer.
- *        Also Pete's target only supports caps from OSDv1 for now
- */
-void osd_set_caps(struct osd_cdb *cdb, const void *caps)
-{
-	bool is_ver1 = true;
-	/* NOTE: They start at same address */
-	memcpy(&cdb->v1.caps, caps, is_ver1 ? OSDv1_CAP_LEN : OSD_CAP_LEN);
-}
-
-bool osd_is_sec_alldata(struct osd_security_parameters *sec_parms __unused)
-{
-	return false;
-}
-
-void osd_sec_sign_cdb(struct osd_cdb *ocdb __unused, const u8 *cap_key __unused)
-{
-}
-
-void osd_sec_sign_data(void *data_integ __unused,
-		       struct bio *bio __unused, const u8 *cap_key __unused)
-{
-}
-
 /*
  * Declared in osd_protocol.h
  * 4.12.5 Data-In and Data-Out buffer offsets
@@ -2052,3 +2787,43 @@ osd_cdb_offset __osd_encode_offset(
 		 be32_offset, *padding);
 	return be32_offset;
 }
+
+/*
+ * module init/exit
+ */
+static int __init osd_initiator_init(void)
+{
+	int ret = osd_sec_init();
+
+	if (ret)
+		return ret;
+
+	osd_request_cachep = kmem_cache_create("osd_request",
+				sizeof(struct osd_request), 0,
+				SLAB_HWCACHE_ALIGN, NULL);
+	if (!osd_request_cachep)
+		goto err_sec;
+
+	osd_request_pool = mempool_create_slab_pool(OSD_REQ_POOL_MIN,
+						    osd_request_cachep);
+	if (!osd_request_pool)
+		goto err_cache;
+
+	return 0;
+
+err_cache:
+	kmem_cache_destroy(osd_request_cachep);
+err_sec:
+	osd_sec_exit();
+	return -ENOMEM;
+}
+
+static void __exit osd_initiator_exit(void)
+{
+	mempool_destroy(osd_request_pool);
+	kmem_cache_destroy(osd_request_cachep);
+	osd_sec_exit();
+}
+
+module_init(osd_initiator_init);
+module_exit(osd_initiator_exit);
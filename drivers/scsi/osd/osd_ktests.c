@@ -78,13 +78,11 @@ static struct osd_request *_start_request(struct osd_dev *od,
 	return or;
 }
 
-static int _exec_only(struct osd_request *or, const struct osd_obj_id *obj,
-		 u8 *caps, const char *msg)
+static int __exec(struct osd_request *or, u8 *caps, const char *msg)
 {
 	int ret;
 	struct osd_sense_info osi;
 
-	osd_sec_init_nosec_doall_caps(caps, obj, false, true);
 	ret = osd_finalize_request(or, 0, caps, NULL);
 	if (ret)
 		goto out;
@@ -103,6 +101,13 @@ out:
 	return ret;
 }
 
+static int _exec_only(struct osd_request *or, const struct osd_obj_id *obj,
+		 u8 *caps, const char *msg)
+{
+	osd_sec_init_nosec_doall_caps(caps, obj, false, true);
+	return __exec(or, caps, msg);
+}
+
 static int _exec(struct osd_request *or, const struct osd_obj_id *obj,
 		 u8 *caps, const char *msg)
 {
@@ -112,6 +117,24 @@ static int _exec(struct osd_request *or, const struct osd_obj_id *obj,
 	return ret;
 }
 
+/* Commands addressed to a collection need a collection capability */
+static int _exec_col_only(struct osd_request *or,
+			  const struct osd_obj_id *col, u8 *caps,
+			  const char *msg)
+{
+	osd_sec_init_nosec_doall_caps(caps, col, true, osd_req_is_ver1(or));
+	return __exec(or, caps, msg);
+}
+
+static int _exec_col(struct osd_request *or, const struct osd_obj_id *col,
+		     u8 *caps, const char *msg)
+{
+	int ret = _exec_col_only(or, col, caps, msg);
+
+	osd_end_request(or);
+	return ret;
+}
+
 static int ktest_format(struct osd_dev *osd_dev)
 {
 	struct osd_request *or;
@@ -254,6 +277,63 @@ static int ktest_read_obj(struct osd_dev *osd_dev, void *write_buff, void *read_
 	return 0;
 }
 
+/* Read the first object in two halves with one prepared request */
+static int ktest_prepared_read(struct osd_dev *osd_dev, void *write_buff,
+			       void *read_buff)
+{
+	struct osd_obj_id obj = {
+		.partition = first_par_id,
+		.id = first_obj_id
+	};
+	unsigned half = BUFF_SIZE / 2;
+	struct osd_sense_info osi;
+	struct osd_request *or;
+	u8 caps[OSD_CAP_LEN];
+	int ret;
+
+	or = _start_request(osd_dev, __func__, __LINE__);
+	if (!or)
+		return -ENOMEM;
+
+	memset(read_buff, 0, BUFF_SIZE);
+	ret = osd_req_read_kern(or, &obj, 0, read_buff, half);
+	if (ret) {
+		OSD_ERR("!!! Failed osd_req_read_kern\n");
+		goto out;
+	}
+
+	osd_sec_init_nosec_doall_caps(caps, &obj, false, true);
+	ret = osd_req_prepare(or, 0, caps, NULL);
+	if (ret) {
+		OSD_ERR("!!! Failed osd_req_prepare => %d\n", ret);
+		goto out;
+	}
+
+	osd_execute_request(or);
+	ret = osd_req_decode_sense(or, &osi);
+	if (ret)
+		goto out;
+
+	ret = osd_req_rebind_kern(or, half, read_buff + half, half);
+	if (ret) {
+		OSD_ERR("!!! Failed osd_req_rebind_kern => %d\n", ret);
+		goto out;
+	}
+
+	osd_execute_request(or);
+	ret = osd_req_decode_sense(or, &osi);
+	if (ret)
+		goto out;
+
+	if (memcmp(read_buff, write_buff, BUFF_SIZE))
+		OSD_ERR("!!! Prepared read did not compare\n");
+	else
+		OSD_INFO("prepared read\n");
+out:
+	osd_end_request(or);
+	return ret;
+}
+
 static int ktest_write_sg_obj(struct osd_dev *osd_dev, void *write_buff)
 {
 	struct osd_request *or;
@@ -375,6 +455,89 @@ static int ktest_read_sg_obj(struct osd_dev *osd_dev,
 	return 0;
 }
 
+/*
+ * The data-out integrity value is hashed from the BIO segments in place.
+ * Check it against the same bytes copied into @flat_buff and hashed at once:
+ * segments of odd sizes, across SHA1 block boundaries, a length that ends
+ * inside a segment, and a length past the end of the chain, which must
+ * fail. Nothing is sent to the target.
+ */
+static int ktest_sign_data(struct osd_dev *osd_dev, void *write_buff,
+			   void *flat_buff)
+{
+	static const unsigned seg_lens[] = {1, 63, 64, 65, 1000, 7, 129};
+	enum { NSEGS = ARRAY_SIZE(seg_lens) };
+	struct osd_obj_id obj = {
+		.partition = first_par_id,
+		.id = first_obj_id,
+	};
+	struct osd_sg_entry sglist[NSEGS];
+	void *buff[NSEGS];
+	u8 cap_key[OSD_SEC_CAP_KEY_LEN];
+	u8 icv[SHA1_DIGEST_SIZE];
+	u8 want[SHA1_DIGEST_SIZE];
+	struct osd_sec_digest dg;
+	struct osd_request *or;
+	u64 total = 0, lens[2];
+	unsigned gap = 0;
+	int s, l;
+	int ret;
+
+	for (s = 0; s < (int)sizeof(cap_key); s++)
+		cap_key[s] = s * 13 + 1;
+
+	/* a gap after each segment so they are not merged into one */
+	for (s = 0; s < NSEGS; s++) {
+		buff[s] = write_buff + total + gap++;
+		sglist[s].offset = total;
+		sglist[s].len = seg_lens[s];
+		memcpy(flat_buff + total, buff[s], seg_lens[s]);
+		total += seg_lens[s];
+	}
+
+	or = _start_request(osd_dev, __func__, __LINE__);
+	if (!or)
+		return -ENOMEM;
+
+	ret = osd_req_write_sg_kern(or, &obj, buff, sglist, NSEGS);
+	if (ret) {
+		OSD_ERR("!!! Failed osd_req_write_sg_kern\n");
+		goto out;
+	}
+
+	lens[0] = total;
+	lens[1] = total - seg_lens[NSEGS - 1] / 2;
+	for (l = 0; l < 2; l++) {
+		ret = osd_sec_sign_data(icv, or->out.bio, lens[l], cap_key);
+		if (!ret)
+			ret = osd_sec_digest_init(&dg, cap_key);
+		if (!ret)
+			ret = osd_sec_digest_update(&dg, flat_buff, lens[l]);
+		if (!ret)
+			ret = osd_sec_digest_final(&dg, want);
+		if (ret)
+			goto out;
+
+		if (memcmp(icv, want, sizeof(icv))) {
+			OSD_ERR("!!! sign_data: bad digest of %llu bytes\n",
+				_LLU(lens[l]));
+			ret = -EIO;
+			goto out;
+		}
+	}
+
+	if (!osd_sec_sign_data(icv, or->out.bio, total + 1, cap_key)) {
+		OSD_ERR("!!! sign_data: short bio chain was signed\n");
+		ret = -EIO;
+		goto out;
+	}
+
+	OSD_INFO("sign_data\n");
+out:
+	osd_end_request(or);
+	return ret;
+}
+
 static int ktest_remove_obj(struct osd_dev *osd_dev)
 {
 	struct osd_request *or;
@@ -428,6 +591,565 @@ static int ktest_remove_par(struct osd_dev *osd_dev)
 	return 0;
 }
 
+/* USERNAME ktest_member_attrs gives the members, ktest_query looks up */
+static char member_name[] = "ktest_member_attrs";
+
+/* ids of the members ktest_collection creates in @col */
+static bool _is_member(const struct osd_obj_id *col, osd_id id)
+{
+	return (id > col->id) && (id <= col->id + num_objects);
+}
+
+static int ktest_member_attrs(struct osd_dev *osd_dev,
+			      const struct osd_obj_id *col)
+{
+	struct osd_attr set_attr = ATTR_SET(OSD_APAGE_OBJECT_INFORMATION,
+		OSD_ATTR_OI_USERNAME, sizeof(member_name), member_name);
+	struct osd_attr get_attr = ATTR_DEF(OSD_APAGE_OBJECT_INFORMATION,
+		OSD_ATTR_OI_USERNAME, sizeof(member_name));
+	struct osd_request *or;
+	u8 caps[OSD_CAP_LEN];
+	void *iter = NULL;
+	int members = 0;
+	int ret;
+
+	or = _start_request(osd_dev, __func__, __LINE__);
+	if (!or)
+		return -ENOMEM;
+
+	osd_req_set_member_attrs(or, col);
+	osd_req_add_set_attr_list(or, &set_attr, 1);
+	ret = _exec_col(or, col, caps, "set_member_attrs");
+	if (ret)
+		return ret;
+
+	or = _start_request(osd_dev, __func__, __LINE__);
+	if (!or)
+		return -ENOMEM;
+
+	osd_req_get_member_attrs(or, col, num_objects);
+	osd_req_add_get_attr_list(or, &get_attr, 1);
+	ret = _exec_col_only(or, col, caps, "get_member_attrs");
+	if (ret)
+		goto out;
+
+	do {
+		struct osd_attr oa;
+		osd_id member_id;
+		int nelem = 1;
+
+		osd_req_decode_member_attrs(or, &member_id, &oa, &nelem,
+					    &iter);
+		if (!nelem)
+			continue;
+
+		if (!_is_member(col, member_id) ||
+		    (oa.len != sizeof(member_name)) ||
+		    memcmp(oa.val_ptr, member_name, sizeof(member_name))) {
+			OSD_ERR("!!! get_member_attrs: bad member 0x%llx\n",
+				_LLU(member_id));
+			ret = -EIO;
+			goto out;
+		}
+		++members;
+	} while (iter);
+
+	if (members != num_objects) {
+		OSD_ERR("!!! get_member_attrs: %d members not %d\n",
+			members, num_objects);
+		ret = -EIO;
+	}
+
+out:
+	osd_end_request(or);
+	return ret;
+}
+
+static int ktest_query(struct osd_dev *osd_dev, const struct osd_obj_id *col)
+{
+	const struct osd_query_criterion crit = {
+		.attr_page = OSD_APAGE_OBJECT_INFORMATION,
+		.attr_id = OSD_ATTR_OI_USERNAME,
+		.min_len = sizeof(member_name),
+		.max_len = sizeof(member_name),
+		.min_val = member_name,
+		.max_val = member_name,
+	};
+	const unsigned nelem = num_objects + 1;
+	struct osd_query_matches_list *matches;
+	struct osd_request *or;
+	u8 caps[OSD_CAP_LEN];
+	unsigned count, i;
+	int ret;
+
+	matches = kzalloc(sizeof(*matches) +
+			  nelem * sizeof(matches->object_ids[0]), GFP_KERNEL);
+	if (!matches)
+		return -ENOMEM;
+
+	or = _start_request(osd_dev, __func__, __LINE__);
+	if (!or) {
+		ret = -ENOMEM;
+		goto free;
+	}
+
+	ret = osd_req_query(or, col, OSD_QUERY_INTERSECTION, &crit, 1,
+			    matches, nelem);
+	if (ret) {
+		osd_end_request(or);
+		goto free;
+	}
+
+	ret = _exec_col(or, col, caps, "query");
+	if (ret)
+		goto free;
+
+	count = osd_query_matches_count(matches);
+	if (count != (unsigned)num_objects) {
+		OSD_ERR("!!! query: %u matches not %d\n", count, num_objects);
+		ret = -EIO;
+		goto free;
+	}
+
+	for (i = 0; i < count; i++) {
+		osd_id id = be64_to_cpu(matches->object_ids[i]);
+
+		if (!_is_member(col, id)) {
+			OSD_ERR("!!! query: 0x%llx is not a member\n",
+				_LLU(id));
+			ret = -EIO;
+			break;
+		}
+	}
+
+free:
+	kfree(matches);
+	return ret;
+}
+
+static int ktest_collection(struct osd_dev *osd_dev)
+{
+	struct osd_obj_id col = {
+		.partition = first_par_id,
+		.id = first_obj_id + num_objects,
+	};
+	__be64 be_cid = cpu_to_be64(col.id);
+	struct osd_attr membership = ATTR_SET(OSD_APAGE_OBJECT_COLLECTIONS,
+		OSD_ATTR_OC_COLLECTION_FIRST, sizeof(be_cid), &be_cid);
+	struct osd_request *or;
+	u8 caps[OSD_CAP_LEN];
+	int ret;
+	int o;
+
+	or = _start_request(osd_dev, __func__, __LINE__);
+	if (!or)
+		return -ENOMEM;
+
+	if (osd_req_is_ver1(or)) {
+		osd_end_request(or);
+		OSD_INFO("collection: skipped, OSD1 target\n");
+		return 0;
+	}
+
+	osd_req_create_collection(or, &col);
+	ret = _exec_col(or, &col, caps, "create_collection");
+	if (ret)
+		return ret;
+
+	for (o = 0; o < num_objects; o++) {
+		struct osd_obj_id obj = {
+			.partition = first_par_id,
+			.id = first_obj_id + num_objects + 1 + o
+		};
+
+		or = _start_request(osd_dev, __func__, __LINE__);
+		if (!or)
+			return -ENOMEM;
+
+		osd_req_create_object(or, &obj);
+		osd_req_add_set_attr_list(or, &membership, 1);
+		ret = _exec(or, &obj, caps, "create_member_object");
+		if (ret)
+			return ret;
+	}
+
+	ret = ktest_member_attrs(osd_dev, &col);
+	if (ret)
+		return ret;
+
+	ret = ktest_query(osd_dev, &col);
+	if (ret)
+		return ret;
+
+	or = _start_request(osd_dev, __func__, __LINE__);
+	if (!or)
+		return -ENOMEM;
+
+	osd_req_remove_member_objects(or, &col);
+	ret = _exec_col(or, &col, caps, "remove_member_objects");
+	if (ret)
+		return ret;
+
+	or = _start_request(osd_dev, __func__, __LINE__);
+	if (!or)
+		return -ENOMEM;
+
+	osd_req_remove_collection(or, &col);
+	return _exec_col(or, &col, caps, "remove_collection");
+}
+
+static int ktest_create_objects(struct osd_dev *osd_dev)
+{
+	struct osd_obj_id par = {
+		.partition = first_par_id,
+		.id = 0
+	};
+	struct osd_request *or;
+	u8 caps[OSD_CAP_LEN];
+	osd_id first_id;
+	int ret;
+	int o;
+
+	or = _start_request(osd_dev, __func__, __LINE__);
+	if (!or)
+		return -ENOMEM;
+
+	ret = osd_req_create_objects(or, par.partition, num_objects);
+	if (ret) {
+		osd_end_request(or);
+		return ret;
+	}
+
+	ret = _exec_only(or, &par, caps, "create_objects");
+	if (!ret)
+		ret = osd_req_decode_created_objects(or, &first_id);
+	osd_end_request(or);
+	if (ret)
+		return ret;
+
+	OSD_INFO("create_objects: first_id=0x%llx count=%d\n",
+		 _LLU(first_id), num_objects);
+
+	for (o = 0; o < num_objects; o++) {
+		struct osd_obj_id obj = {
+			.partition = first_par_id,
+			.id = first_id + o
+		};
+
+		or = _start_request(osd_dev, __func__, __LINE__);
+		if (!or)
+			return -ENOMEM;
+
+		osd_req_remove_object(or, &obj);
+		ret = _exec(or, &obj, caps, "remove_created_object");
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+static int ktest_create_and_write(struct osd_dev *osd_dev, void *write_buff,
+				  void *read_buff)
+{
+	struct osd_obj_id obj = {
+		.partition = first_par_id,
+		.id = first_obj_id + 2 * num_objects + 1,
+	};
+	struct osd_request *or;
+	u8 caps[OSD_CAP_LEN];
+	int ret;
+
+	or = _start_request(osd_dev, __func__, __LINE__);
+	if (!or)
+		return -ENOMEM;
+
+	ret = osd_req_create_and_write_kern(or, &obj, 0, write_buff,
+					    BUFF_SIZE);
+	if (ret) {
+		OSD_ERR("!!! Failed osd_req_create_and_write_kern\n");
+		osd_end_request(or);
+		return ret;
+	}
+
+	ret = _exec(or, &obj, caps, "create_and_write");
+	if (ret)
+		return ret;
+
+	or = _start_request(osd_dev, __func__, __LINE__);
+	if (!or)
+		return -ENOMEM;
+
+	ret = osd_req_read_kern(or, &obj, 0, read_buff, BUFF_SIZE);
+	if (ret) {
+		OSD_ERR("!!! Failed osd_req_read_kern\n");
+		osd_end_request(or);
+		return ret;
+	}
+
+	ret = _exec(or, &obj, caps, "read_created");
+	if (ret)
+		return ret;
+
+	if (memcmp(read_buff, write_buff, BUFF_SIZE))
+		OSD_ERR("!!! Read did not compare\n");
+
+	or = _start_request(osd_dev, __func__, __LINE__);
+	if (!or)
+		return -ENOMEM;
+
+	osd_req_remove_object(or, &obj);
+	return _exec(or, &obj, caps, "remove_created");
+}
+
+/* Append the two halves of write_buff to a new object, each lands where
+ * the previous one ended
+ */
+static int ktest_append(struct osd_dev *osd_dev, void *write_buff,
+			void *read_buff)
+{
+	struct osd_obj_id obj = {
+		.partition = first_par_id,
+		.id = first_obj_id + 2 * num_objects + 3,
+	};
+	const unsigned half = BUFF_SIZE / 2;
+	struct osd_request *or;
+	u8 caps[OSD_CAP_LEN];
+	u64 offset;
+	unsigned i;
+	int ret;
+
+	or = _start_request(osd_dev, __func__, __LINE__);
+	if (!or)
+		return -ENOMEM;
+
+	osd_req_create_object(or, &obj);
+	ret = _exec(or, &obj, caps, "create_append");
+	if (ret)
+		return ret;
+
+	for (i = 0; i < 2; i++) {
+		or = _start_request(osd_dev, __func__, __LINE__);
+		if (!or)
+			return -ENOMEM;
+
+		ret = osd_req_append_kern(or, &obj, write_buff + i * half,
+					  half);
+		if (ret) {
+			OSD_ERR("!!! Failed osd_req_append_kern\n");
+			osd_end_request(or);
+			return ret;
+		}
+
+		ret = _exec_only(or, &obj, caps, "append");
+		if (!ret)
+			ret = osd_req_decode_append_offset(or, &offset);
+		osd_end_request(or);
+		if (ret)
+			return ret;
+
+		if (offset != i * half) {
+			OSD_ERR("!!! append %u landed at 0x%llx\n", i,
+				_LLU(offset));
+			return -EIO;
+		}
+	}
+
+	or = _start_request(osd_dev, __func__, __LINE__);
+	if (!or)
+		return -ENOMEM;
+
+	ret = osd_req_read_kern(or, &obj, 0, read_buff, BUFF_SIZE);
+	if (ret) {
+		OSD_ERR("!!! Failed osd_req_read_kern\n");
+		osd_end_request(or);
+		return ret;
+	}
+
+	ret = _exec(or, &obj, caps, "read_appended");
+	if (ret)
+		return ret;
+
+	if (memcmp(read_buff, write_buff, BUFF_SIZE))
+		OSD_ERR("!!! Read did not compare\n");
+
+	or = _start_request(osd_dev, __func__, __LINE__);
+	if (!or)
+		return -ENOMEM;
+
+	osd_req_remove_object(or, &obj);
+	return _exec(or, &obj, caps, "remove_appended");
+}
+
+/* Punch the first half and clear the second half of a new object */
+static int ktest_punch_clear(struct osd_dev *osd_dev, void *write_buff,
+			     void *read_buff)
+{
+	struct osd_obj_id obj = {
+		.partition = first_par_id,
+		.id = first_obj_id + 2 * num_objects + 2,
+	};
+	const unsigned half = BUFF_SIZE / 2;
+	struct osd_request *or;
+	u8 caps[OSD_CAP_LEN];
+	unsigned i;
+	int ret;
+
+	or = _start_request(osd_dev, __func__, __LINE__);
+	if (!or)
+		return -ENOMEM;
+
+	if (osd_req_is_ver1(or)) {
+		osd_end_request(or);
+		OSD_INFO("punch_clear: skipped, OSD1 target\n");
+		return 0;
+	}
+
+	ret = osd_req_create_and_write_kern(or, &obj, 0, write_buff,
+					    BUFF_SIZE);
+	if (ret) {
+		osd_end_request(or);
+		return ret;
+	}
+	ret = _exec(or, &obj, caps, "create_and_write");
+	if (ret)
+		return ret;
+
+	or = _start_request(osd_dev, __func__, __LINE__);
+	if (!or)
+		return -ENOMEM;
+	osd_req_punch(or, &obj, 0, half);
+	ret = _exec(or, &obj, caps, "punch");
+	if (ret)
+		return ret;
+
+	or = _start_request(osd_dev, __func__, __LINE__);
+	if (!or)
+		return -ENOMEM;
+	osd_req_clear(or, &obj, half, BUFF_SIZE - half);
+	ret = _exec(or, &obj, caps, "clear");
+	if (ret)
+		return ret;
+
+	or = _start_request(osd_dev, __func__, __LINE__);
+	if (!or)
+		return -ENOMEM;
+	memset(read_buff, 0xff, BUFF_SIZE);
+	ret = osd_req_read_kern(or, &obj, 0, read_buff, BUFF_SIZE);
+	if (ret) {
+		osd_end_request(or);
+		return ret;
+	}
+	ret = _exec(or, &obj, caps, "read_punched");
+	if (ret)
+		return ret;
+
+	for (i = 0; i < BUFF_SIZE; i++)
+		if (((u8 *)read_buff)[i]) {
+			OSD_ERR("!!! Punched/cleared byte %u not zero\n", i);
+			ret = -EIO;
+			break;
+		}
+
+	or = _start_request(osd_dev, __func__, __LINE__);
+	if (!or)
+		return -ENOMEM;
+	osd_req_remove_object(or, &obj);
+	if (ret) {
+		_exec(or, &obj, caps, NULL);
+		return ret;
+	}
+	return _exec(or, &obj, caps, "remove_punched");
+}
+
+static int ktest_snapshot(struct osd_dev *osd_dev)
+{
+	struct osd_obj_id snap = {
+		.partition = first_par_id + num_partitions,
+		.id = 0
+	};
+	struct osd_obj_id par = {
+		.partition = first_par_id,
+		.id = 0
+	};
+	struct osd_request *or;
+	u8 caps[OSD_CAP_LEN];
+	int ret;
+
+	or = _start_request(osd_dev, __func__, __LINE__);
+	if (!or)
+		return -ENOMEM;
+
+	if (osd_req_is_ver1(or)) {
+		osd_end_request(or);
+		OSD_INFO("snapshot: skipped, OSD1 target\n");
+		return 0;
+	}
+
+	osd_req_create_snapshot(or, par.partition, snap.partition);
+	ret = _exec(or, &par, caps, "create_snapshot");
+	if (ret)
+		return ret;
+
+	or = _start_request(osd_dev, __func__, __LINE__);
+	if (!or)
+		return -ENOMEM;
+
+	osd_req_remove_partition(or, snap.partition);
+	return _exec(or, &snap, caps, "remove_snapshot");
+}
+
+/* The first object was written from offset 0, its map must say so */
+static int ktest_read_map(struct osd_dev *osd_dev, void *buff)
+{
+	struct osd_obj_id obj = {
+		.partition = first_par_id,
+		.id = first_obj_id
+	};
+	struct osd_map_list *list = buff;
+	unsigned nelem = (BUFF_SIZE - sizeof(*list)) / sizeof(list->maps[0]);
+	struct osd_request *or;
+	u8 caps[OSD_CAP_LEN];
+	unsigned i, count;
+	int ret;
+
+	or = _start_request(osd_dev, __func__, __LINE__);
+	if (!or)
+		return -ENOMEM;
+
+	if (osd_req_is_ver1(or)) {
+		osd_end_request(or);
+		OSD_INFO("read_map: skipped, OSD1 target\n");
+		return 0;
+	}
+
+	ret = osd_req_read_map(or, &obj, 0, OSD_MAP_WRITTEN_DATA, list, nelem);
+	if (ret) {
+		osd_end_request(or);
+		return ret;
+	}
+
+	ret = _exec(or, &obj, caps, "read_map");
+	if (ret)
+		return ret;
+
+	count = min(osd_map_list_count(list), nelem);
+	for (i = 0; i < count; i++) {
+		struct osd_map_descriptor *md = &list->maps[i];
+
+		OSD_INFO("read_map: [0x%llx, +0x%llx) type=%d\n",
+			 _LLU(be64_to_cpu(md->offset)),
+			 _LLU(be64_to_cpu(md->length)),
+			 be16_to_cpu(md->map_type));
+		if ((be16_to_cpu(md->map_type) == OSD_MAP_WRITTEN_DATA) &&
+		    !be64_to_cpu(md->offset))
+			return 0;
+	}
+
+	OSD_ERR("!!! read_map: written range at 0 missing\n");
+	return -EIO;
+}
+
 static int ktest_write_read_attr(struct osd_dev *osd_dev, void *buff,
 	bool doread, bool doset, bool doget)
 {
@@ -479,22 +1201,16 @@ static int ktest_write_read_attr(struct osd_dev *osd_dev, void *buff,
 
 	ret = _exec_only(or, &obj, caps, NULL);
 	if (!ret && doget) {
-		void *iter = NULL, *pFirst, *pSec;
-		int nelem = 2;
 		u64 capacity_len = ~0;
 		u64 logical_len = ~0;
 
-		osd_req_decode_get_attr_list(or, get_attrs, &nelem, &iter);
-
-		/*FIXME: Std does not guaranty order of return attrs */
-		pFirst = get_attrs[0].val_ptr;
-		if (pFirst)
-			capacity_len = get_unaligned_be64(pFirst);
+		/* Std does not guaranty order of return attrs, look them up */
+		if (!osd_req_find_get_attr(or, &get_attrs[0]))
+			capacity_len = get_unaligned_be64(get_attrs[0].val_ptr);
 		else
 			OSD_ERR("failed to read capacity_used\n");
-		pSec = get_attrs[1].val_ptr;
-		if (pSec)
-			logical_len = get_unaligned_be64(pSec);
+		if (!osd_req_find_get_attr(or, &get_attrs[1]))
+			logical_len = get_unaligned_be64(get_attrs[1].val_ptr);
 		else
 			OSD_ERR("failed to read logical_length\n");
 		OSD_INFO("%s capacity=%llu len=%llu\n",
@@ -631,6 +1347,11 @@ int do_test_17(struct osd_dev *od, unsigned cmd __unused,
 	if (ret)
 		goto dev_fini;
 
+/* read again with a prepared request */
+	ret = ktest_prepared_read(od, write_buff, read_buff);
+	if (ret)
+		goto dev_fini;
+
 /* write sg to objects */
 	ret = ktest_write_sg_obj(od, write_buff);
 	if (ret)
@@ -641,6 +1362,11 @@ int do_test_17(struct osd_dev *od, unsigned cmd __unused,
 	if (ret)
 		goto dev_fini;
 
+/* data integrity value of a multi-segment bio */
+	ret = ktest_sign_data(od, write_buff, read_buff);
+	if (ret)
+		goto dev_fini;
+
 /* List all objects */
 
 /* Write with get_attr */
@@ -693,11 +1419,46 @@ int do_test_17(struct osd_dev *od, unsigned cmd __unused,
 	if (ret)
 		goto dev_fini;
 */
+/* map of written ranges */
+	ret = ktest_read_map(od, read_buff);
+	if (ret)
+		goto dev_fini;
+
 /* remove objects */
 	ret = ktest_remove_obj(od);
 	if (ret)
 		goto dev_fini;
 
+/* create a collection with members and remove them in one go */
+	ret = ktest_collection(od);
+	if (ret)
+		goto dev_fini;
+
+/* create objects with target assigned ids in one command */
+	ret = ktest_create_objects(od);
+	if (ret)
+		goto dev_fini;
+
+/* create an object and write to it in one command */
+	ret = ktest_create_and_write(od, write_buff, read_buff);
+	if (ret)
+		goto dev_fini;
+
+/* append to an object at target chosen offsets */
+	ret = ktest_append(od, write_buff, read_buff);
+	if (ret)
+		goto dev_fini;
+
+/* punch and clear ranges of an object */
+	ret = ktest_punch_clear(od, write_buff, read_buff);
+	if (ret)
+		goto dev_fini;
+
+/* snapshot the (now empty) partition and remove the snapshot */
+	ret = ktest_snapshot(od);
+	if (ret)
+		goto dev_fini;
+
 /* remove partitions */
 	ret = ktest_remove_par(od);
 	if (ret)
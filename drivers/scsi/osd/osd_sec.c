@@ -0,0 +1,334 @@
+/*
+ * osd_sec.c - Implementation of the osd_sec.h API
+ *
+ * Capabilities, and the HMAC-SHA1 integrity check values of the CAPKEY,
+ * CMDRSP and ALLDATA security methods.
+ *
+ * Copyright (C) 2008 Panasas Inc.  All rights reserved.
+ *
+ * Authors:
+ *   Boaz Harrosh <bharrosh@panasas.com>
+ *   Benny Halevy <bhalevy@panasas.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2
+ *
+ */
+
+#include <linux/blkdev.h>
+#include <linux/spinlock.h>
+#ifdef __KERNEL__
+#include <linux/highmem.h>
+#endif
+#include <crypto/hash.h>
+#include <crypto/sha.h>
+
+#include <scsi/osd_sec.h>
+
+#include "osd_debug.h"
+
+enum { OSD_SEC_CAP_V1_ALL_CAPS =
+	OSD_SEC_CAP_APPEND | OSD_SEC_CAP_OBJ_MGMT | OSD_SEC_CAP_REMOVE   |
+	OSD_SEC_CAP_CREATE | OSD_SEC_CAP_SET_ATTR | OSD_SEC_CAP_GET_ATTR |
+	OSD_SEC_CAP_WRITE  | OSD_SEC_CAP_READ     | OSD_SEC_CAP_POL_SEC  |
+	OSD_SEC_CAP_GLOBAL | OSD_SEC_CAP_DEV_MGMT
+};
+
+enum { OSD_SEC_CAP_V2_ALL_CAPS =
+	OSD_SEC_CAP_V1_ALL_CAPS | OSD_SEC_CAP_QUERY | OSD_SEC_CAP_M_OBJECT
+};
+
+void osd_sec_init_nosec_doall_caps(void *caps,
+	const struct osd_obj_id *obj, bool is_collection, const bool is_v1)
+{
+	struct osd_capability *cap = caps;
+	u8 type;
+	u8 descriptor_type;
+
+	if (likely(obj->id)) {
+		if (unlikely(is_collection)) {
+			type = OSD_SEC_OBJ_COLLECTION;
+			descriptor_type = is_v1 ? OSD_SEC_OBJ_DESC_OBJ :
+						  OSD_SEC_OBJ_DESC_COL;
+		} else {
+			type = OSD_SEC_OBJ_USER;
+			descriptor_type = OSD_SEC_OBJ_DESC_OBJ;
+		}
+		WARN_ON(!obj->partition);
+	} else {
+		type = obj->partition ? OSD_SEC_OBJ_PARTITION :
+					OSD_SEC_OBJ_ROOT;
+		descriptor_type = OSD_SEC_OBJ_DESC_PAR;
+	}
+
+	memset(cap, 0, sizeof(*cap));
+
+	cap->h.format = OSD_SEC_CAP_FORMAT_VER1;
+	cap->h.integrity_algorithm__key_version = 0; /* MAKE_BYTE(0, 0); */
+	cap->h.security_method = OSD_SEC_NOSEC;
+/*	cap->expiration_time;
+	cap->AUDIT[30-10];
+	cap->discriminator[42-30];
+	cap->object_created_time; */
+	cap->h.object_type = type;
+	osd_sec_set_caps(&cap->h, OSD_SEC_CAP_V1_ALL_CAPS);
+	cap->h.object_descriptor_type = descriptor_type;
+	cap->od.obj_desc.policy_access_tag = 0;
+	cap->od.obj_desc.allowed_partition_id = cpu_to_be64(obj->partition);
+	cap->od.obj_desc.allowed_object_id = cpu_to_be64(obj->id);
+}
+EXPORT_SYMBOL(osd_sec_init_nosec_doall_caps);
+
+/* FIXME: Extract version from caps pointer.
+ *        Also Pete's target only supports caps from OSDv1 for now
+ */
+void osd_set_caps(struct osd_cdb *cdb, const void *caps)
+{
+	bool is_ver1 = true;
+	/* NOTE: They start at same address */
+	memcpy(&cdb->v1.caps, caps, is_ver1 ? OSDv1_CAP_LEN : OSD_CAP_LEN);
+}
+
+/*
+ * HMAC-SHA1 with the capability key.
+ * The key is shorter than a SHA1 block so the two padded keys hash to one
+ * block each. Their SHA1 states are exported once per key and cached,
+ * signing then costs only the SHA1 of the data plus one block. The "sha1"
+ * tfm is keyless and shared by all requests, the crypto layer picks the
+ * fastest implementation the CPU supports.
+ */
+enum {
+	OSD_SEC_HMAC_IPAD = 0x36,
+	OSD_SEC_HMAC_OPAD = 0x5c,
+	/* Capability keys are HMAC-SHA1 outputs, so uniformly distributed
+	 * and their first byte is a good enough hash.
+	 */
+	OSD_SEC_KEY_CACHE_SIZE = 32,
+};
+
+struct osd_sec_key_state {
+	u8 key[OSD_SEC_CAP_KEY_LEN];
+	bool valid;
+	struct sha1_state ipad;
+	struct sha1_state opad;
+};
+
+/* crypto_shash_update() takes an unsigned length, longer buffers are fed
+ * in whole SHA1 blocks chunks
+ */
+#define OSD_SEC_DIGEST_MAX_CHUNK (UINT_MAX & ~(SHA1_BLOCK_SIZE - 1))
+
+static struct crypto_shash *osd_sha1_tfm;
+static DEFINE_SPINLOCK(osd_sec_key_lock);
+static struct osd_sec_key_state osd_sec_key_cache[OSD_SEC_KEY_CACHE_SIZE];
+
+static int _sha1_pad_state(struct shash_desc *desc, const u8 *cap_key,
+	u8 pad, struct sha1_state *state)
+{
+	u8 block[SHA1_BLOCK_SIZE];
+	unsigned i;
+	int ret;
+
+	for (i = 0; i < OSD_SEC_CAP_KEY_LEN; i++)
+		block[i] = cap_key[i] ^ pad;
+	memset(block + i, pad, SHA1_BLOCK_SIZE - i);
+
+	ret = crypto_shash_init(desc);
+	if (!ret)
+		ret = crypto_shash_update(desc, block, SHA1_BLOCK_SIZE);
+	if (!ret)
+		ret = crypto_shash_export(desc, state);
+
+	memset(block, 0, sizeof(block));
+	return ret;
+}
+
+int osd_sec_digest_init(struct osd_sec_digest *dg, const u8 *cap_key)
+{
+	struct osd_sec_key_state *ks =
+			&osd_sec_key_cache[cap_key[0] % OSD_SEC_KEY_CACHE_SIZE];
+	struct sha1_state ipad;
+	bool hit;
+	int ret;
+
+	dg->shash.tfm = osd_sha1_tfm;
+	dg->shash.flags = 0;
+
+	spin_lock(&osd_sec_key_lock);
+	hit = ks->valid && !memcmp(ks->key, cap_key, OSD_SEC_CAP_KEY_LEN);
+	if (hit) {
+		ipad = ks->ipad;
+		dg->opad = ks->opad;
+	}
+	spin_unlock(&osd_sec_key_lock);
+
+	if (!hit) {
+		ret = _sha1_pad_state(&dg->shash, cap_key, OSD_SEC_HMAC_IPAD,
+				      &ipad);
+		if (!ret)
+			ret = _sha1_pad_state(&dg->shash, cap_key,
+					      OSD_SEC_HMAC_OPAD, &dg->opad);
+		if (unlikely(ret))
+			return ret;
+
+		spin_lock(&osd_sec_key_lock);
+		memcpy(ks->key, cap_key, OSD_SEC_CAP_KEY_LEN);
+		ks->ipad = ipad;
+		ks->opad = dg->opad;
+		ks->valid = true;
+		spin_unlock(&osd_sec_key_lock);
+	}
+
+	return crypto_shash_import(&dg->shash, &ipad);
+}
+EXPORT_SYMBOL(osd_sec_digest_init);
+
+int osd_sec_digest_update(struct osd_sec_digest *dg, const void *buff,
+	u64 len)
+{
+	const u8 *p = buff;
+	int ret = 0;
+
+	while (len && !ret) {
+		unsigned this_len = len > OSD_SEC_DIGEST_MAX_CHUNK ?
+					OSD_SEC_DIGEST_MAX_CHUNK : len;
+
+		ret = crypto_shash_update(&dg->shash, p, this_len);
+		p += this_len;
+		len -= this_len;
+	}
+	return ret;
+}
+EXPORT_SYMBOL(osd_sec_digest_update);
+
+int osd_sec_digest_update_bio(struct osd_sec_digest *dg, struct bio *bio,
+	u64 len)
+{
+	int ret = 0;
+
+	for (; bio && len && !ret; bio = bio->bi_next) {
+#ifdef __KERNEL__
+		struct bio_vec *bv;
+		int i;
+
+		bio_for_each_segment(bv, bio, i) {
+			unsigned this_len = min_t(u64, bv->bv_len, len);
+			u8 *p = kmap_atomic(bv->bv_page, KM_USER0);
+
+			ret = crypto_shash_update(&dg->shash,
+						  p + bv->bv_offset, this_len);
+			kunmap_atomic(p, KM_USER0);
+			len -= this_len;
+			if (ret || !len)
+				break;
+		}
+#else
+		unsigned i;
+
+		for (i = 0; i < bio->bi_vecs; i++) {
+			u64 this_len = min((u64)bio->bi_vec[i].len, len);
+
+			ret = osd_sec_digest_update(dg, bio->bi_vec[i].mem,
+						    this_len);
+			len -= this_len;
+			if (ret || !len)
+				break;
+		}
+#endif
+	}
+
+	if (unlikely(!ret && len)) {
+		OSD_ERR("data integrity: bio chain is %llu bytes short\n",
+			_LLU(len));
+		ret = -EINVAL;
+	}
+	return ret;
+}
+EXPORT_SYMBOL(osd_sec_digest_update_bio);
+
+int osd_sec_digest_final(struct osd_sec_digest *dg, u8 *icv)
+{
+	u8 inner[SHA1_DIGEST_SIZE];
+	int ret;
+
+	ret = crypto_shash_final(&dg->shash, inner);
+	if (!ret)
+		ret = crypto_shash_import(&dg->shash, &dg->opad);
+	if (!ret)
+		ret = crypto_shash_update(&dg->shash, inner, sizeof(inner));
+	if (!ret)
+		ret = crypto_shash_final(&dg->shash, icv);
+	return ret;
+}
+EXPORT_SYMBOL(osd_sec_digest_final);
+
+int osd_sec_sign_cdb(struct osd_cdb *ocdb, const u8 *cap_key, bool is_v1)
+{
+	u8 *icv = is_v1 ? ocdb->v1.sec_params.integrity_check_value :
+			  ocdb->v2.sec_params.integrity_check_value;
+	unsigned icv_len = is_v1 ? OSDv1_CRYPTO_KEYID_SIZE :
+				   OSDv2_CRYPTO_KEYID_SIZE;
+	unsigned cdb_len = is_v1 ? OSDv1_TOTAL_CDB_LEN : OSD_TOTAL_CDB_LEN;
+	struct osd_sec_digest dg;
+	int ret;
+
+	if (osd_sec_method(ocdb) == OSD_SEC_NOSEC)
+		return 0;
+
+	if (WARN_ON(!cap_key))
+		return -EINVAL;
+
+	/* The CDB is signed with its integrity check value zeroed */
+	memset(icv, 0, icv_len);
+
+	ret = osd_sec_digest_init(&dg, cap_key);
+	if (!ret)
+		ret = osd_sec_digest_update(&dg, ocdb->buff, cdb_len);
+	if (!ret)
+		ret = osd_sec_digest_final(&dg, icv);
+	return ret;
+}
+
+int osd_sec_sign_data(void *data_integ, struct bio *bio, u64 len,
+	const u8 *cap_key)
+{
+	struct osd_sec_digest dg;
+	int ret;
+
+	if (WARN_ON(!cap_key))
+		return -EINVAL;
+
+	ret = osd_sec_digest_init(&dg, cap_key);
+	if (!ret)
+		ret = osd_sec_digest_update_bio(&dg, bio, len);
+	if (!ret)
+		ret = osd_sec_digest_final(&dg, data_integ);
+	return ret;
+}
+
+int osd_sec_init(void)
+{
+	struct crypto_shash *tfm = crypto_alloc_shash("sha1", 0, 0);
+
+	if (IS_ERR(tfm)) {
+		OSD_ERR("Failed to allocate sha1 => %ld\n", PTR_ERR(tfm));
+		return PTR_ERR(tfm);
+	}
+
+	if (crypto_shash_descsize(tfm) > sizeof(struct sha1_state) ||
+	    crypto_shash_statesize(tfm) != sizeof(struct sha1_state)) {
+		OSD_ERR("Unexpected sha1 state size\n");
+		crypto_free_shash(tfm);
+		return -EINVAL;
+	}
+
+	osd_sha1_tfm = tfm;
+	return 0;
+}
+
+void osd_sec_exit(void)
+{
+	crypto_free_shash(osd_sha1_tfm);
+	osd_sha1_tfm = NULL;
+	memset(osd_sec_key_cache, 0, sizeof(osd_sec_key_cache));
+}
@@ -137,6 +137,7 @@ struct exofs_io_state {
 	unsigned		nr_pages;
 	unsigned		pgbase;
 	unsigned		pages_consumed;
+	bool			create; /* write with CREATE_AND_WRITE */
 
 	/* Attributes */
 	unsigned		in_attr_len;
@@ -166,6 +167,7 @@ static inline unsigned exofs_io_state_size(unsigned numdevs)
  */
 #define OBJ_2BCREATED	0	/* object will be created soon*/
 #define OBJ_CREATED	1	/* object has been created on the osd*/
+#define OBJ_DEFER_CREATE 2	/* object will be created by its first write*/
 
 static inline int obj_2bcreated(struct exofs_i_info *oi)
 {
@@ -187,6 +189,11 @@ static inline void set_obj_created(struct exofs_i_info *oi)
 	set_bit(OBJ_CREATED, &oi->i_flags);
 }
 
+static inline int obj_create_deferred(struct exofs_i_info *oi)
+{
+	return test_bit(OBJ_DEFER_CREATE, &oi->i_flags);
+}
+
 int __exofs_wait_obj_created(struct exofs_i_info *oi);
 static inline int wait_obj_created(struct exofs_i_info *oi)
 {
@@ -239,6 +246,15 @@ int exofs_sbi_read(struct exofs_io_state *ios);
 int extract_attr_from_ios(struct exofs_io_state *ios, struct osd_attr *attr);
 
 int exofs_oi_truncate(struct exofs_i_info *oi, u64 new_len);
+int exofs_oi_punch(struct exofs_i_info *oi, u64 offset, u64 length,
+		   bool clear);
+
+/* Called for each written range of the file in order. A non-zero return
+ * stops the walk, negative is returned as the error.
+ */
+typedef int (*exofs_map_fn)(void *priv, u64 offset, u64 length);
+int exofs_oi_read_map(struct exofs_i_info *oi, u64 offset, u64 length,
+		      exofs_map_fn fn, void *priv);
 static inline int exofs_oi_write(struct exofs_i_info *oi,
 				 struct exofs_io_state *ios)
 {
@@ -30,8 +30,18 @@
  * along with exofs; if not, write to the Free Software
  * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
  */
+#include <linux/falloc.h>
+
 #include "exofs.h"
 
+/* missing from older kernel headers */
+#ifndef FALLOC_FL_PUNCH_HOLE
+#  define FALLOC_FL_PUNCH_HOLE	0x02
+#endif
+#ifndef FALLOC_FL_ZERO_RANGE
+#  define FALLOC_FL_ZERO_RANGE	0x10
+#endif
+
 static int exofs_release_file(struct inode *inode, struct file *filp)
 {
 	return 0;
@@ -75,8 +85,237 @@ static int exofs_flush(struct file *file, fl_owner_t id)
 	return ret;
 }
 
+/* exofs_fallocate - punch a hole or zero a range of the file
+ *
+ *   The range is sent as an OSD PUNCH or CLEAR on every component, no zero
+ *   pages go over the wire. Plain preallocation is not supported, objects
+ *   allocate on write.
+ */
+static long exofs_fallocate(struct file *file, int mode, loff_t offset,
+			    loff_t len)
+{
+	struct inode *inode = file->f_mapping->host;
+	struct exofs_i_info *oi = exofs_i(inode);
+	bool clear = (mode & FALLOC_FL_ZERO_RANGE) != 0;
+	loff_t end = offset + len;
+	loff_t i_size, op_end;
+	int ret;
+
+	if (mode & ~(FALLOC_FL_KEEP_SIZE | FALLOC_FL_PUNCH_HOLE |
+		     FALLOC_FL_ZERO_RANGE))
+		return -EOPNOTSUPP;
+
+	/* punch must keep the size, and is exclusive with zero */
+	if (mode & FALLOC_FL_PUNCH_HOLE) {
+		if (clear || !(mode & FALLOC_FL_KEEP_SIZE))
+			return -EOPNOTSUPP;
+	} else if (!clear) {
+		return -EOPNOTSUPP;
+	}
+
+	mutex_lock(&inode->i_mutex);
+
+	ret = wait_obj_created(oi);
+	if (unlikely(ret))
+		goto out;
+
+	/* Past EOF is already a hole */
+	i_size = i_size_read(inode);
+	op_end = min(end, i_size);
+
+	if (offset < op_end) {
+		/* Dirty pages must not land on top of the punched range */
+		ret = filemap_write_and_wait_range(inode->i_mapping, offset,
+						   op_end - 1);
+		if (unlikely(ret))
+			goto out;
+
+		ret = exofs_oi_punch(oi, offset, op_end - offset, clear);
+		if (unlikely(ret))
+			goto out;
+
+		ret = invalidate_inode_pages2_range(inode->i_mapping,
+					offset >> PAGE_CACHE_SHIFT,
+					(op_end - 1) >> PAGE_CACHE_SHIFT);
+		if (unlikely(ret))
+			goto out;
+	}
+
+	if (clear && !(mode & FALLOC_FL_KEEP_SIZE) && (end > i_size)) {
+		ret = exofs_oi_truncate(oi, end);
+		if (unlikely(ret))
+			goto out;
+		i_size_write(inode, end);
+	}
+
+	inode->i_mtime = inode->i_ctime = CURRENT_TIME;
+	mark_inode_dirty(inode);
+
+out:
+	mutex_unlock(&inode->i_mutex);
+	EXOFS_DBGMSG("(0x%lx) mode=0x%x offset=0x%llx len=0x%llx ret=>%d\n",
+		     inode->i_ino, mode, _LLU(offset), _LLU(len), ret);
+	return ret;
+}
+
+/* Report a file's written ranges, as the OSD READ MAP sees them */
+struct _fiemap_state {
+	struct fiemap_extent_info *fieinfo;
+	u64 offset;
+	u64 length; /* 0 means no pending extent */
+};
+
+static int _fiemap_fill(void *priv, u64 offset, u64 length)
+{
+	struct _fiemap_state *fs = priv;
+	int ret = 0;
+
+	/* One behind, so the last one can be flagged */
+	if (fs->length)
+		ret = fiemap_fill_next_extent(fs->fieinfo, fs->offset, 0,
+				fs->length, FIEMAP_EXTENT_UNKNOWN);
+	fs->offset = offset;
+	fs->length = length;
+	return ret;
+}
+
+static int exofs_fiemap(struct inode *inode, struct fiemap_extent_info *fieinfo,
+			u64 start, u64 len)
+{
+	struct exofs_i_info *oi = exofs_i(inode);
+	struct _fiemap_state fs = {.fieinfo = fieinfo};
+	loff_t i_size;
+	int ret;
+
+	ret = fiemap_check_flags(fieinfo, FIEMAP_FLAG_SYNC);
+	if (ret)
+		return ret;
+
+	if (fieinfo->fi_flags & FIEMAP_FLAG_SYNC) {
+		ret = filemap_write_and_wait(inode->i_mapping);
+		if (ret)
+			return ret;
+	}
+
+	/* Nothing written yet, no object */
+	if (obj_create_deferred(oi))
+		return 0;
+
+	ret = wait_obj_created(oi);
+	if (unlikely(ret))
+		return ret;
+
+	i_size = i_size_read(inode);
+	if (start >= i_size)
+		return 0;
+	if (len > i_size - start)
+		len = i_size - start;
+
+	ret = exofs_oi_read_map(oi, start, len, _fiemap_fill, &fs);
+	if (ret)
+		return ret;
+
+	if (fs.length && !(fieinfo->fi_extents_max &&
+			   fieinfo->fi_extents_mapped >=
+			   fieinfo->fi_extents_max))
+		ret = fiemap_fill_next_extent(fieinfo, fs.offset, 0, fs.length,
+				FIEMAP_EXTENT_UNKNOWN | FIEMAP_EXTENT_LAST);
+
+	return ret < 0 ? ret : 0;
+}
+
+#ifdef SEEK_DATA
+struct _seek_state {
+	int origin;
+	loff_t pos;
+};
+
+static int _seek_fn(void *priv, u64 offset, u64 length)
+{
+	struct _seek_state *ss = priv;
+
+	if (ss->origin == SEEK_DATA) {
+		ss->pos = max_t(loff_t, ss->pos, offset);
+		return 1;
+	}
+
+	/* SEEK_HOLE */
+	if (offset > ss->pos)
+		return 1;
+	ss->pos = max_t(loff_t, ss->pos, offset + length);
+	return 0;
+}
+
+/* SEEK_DATA/SEEK_HOLE from the OSD map of the file's components */
+static loff_t exofs_file_llseek(struct file *file, loff_t offset, int origin)
+{
+	struct inode *inode = file->f_mapping->host;
+	struct exofs_i_info *oi = exofs_i(inode);
+	struct _seek_state ss = {.origin = origin, .pos = -1};
+	loff_t i_size;
+	int ret;
+
+	if ((origin != SEEK_DATA) && (origin != SEEK_HOLE))
+		return generic_file_llseek(file, offset, origin);
+
+	mutex_lock(&inode->i_mutex);
+
+	i_size = i_size_read(inode);
+	if ((offset < 0) || (offset >= i_size)) {
+		ret = -ENXIO;
+		goto out;
+	}
+
+	/* The map must include what is still in the page cache */
+	ret = filemap_write_and_wait(inode->i_mapping);
+	if (unlikely(ret))
+		goto out;
+
+	if (obj_create_deferred(oi)) {
+		/* Never written, all a hole */
+		ss.pos = (origin == SEEK_DATA) ? -1 : offset;
+	} else {
+		ret = wait_obj_created(oi);
+		if (unlikely(ret))
+			goto out;
+
+		if (origin == SEEK_HOLE)
+			ss.pos = offset;
+		ret = exofs_oi_read_map(oi, offset, i_size - offset, _seek_fn,
+					&ss);
+		if (unlikely(ret)) {
+			/* OSD1, or a target without READ MAP. Like the
+			 * generic llseek, the whole file is data.
+			 */
+			EXOFS_DBGMSG("exofs_oi_read_map(0x%lx) => %d\n",
+				     inode->i_ino, ret);
+			ss.pos = (origin == SEEK_DATA) ? offset : i_size;
+			ret = 0;
+		}
+	}
+
+	if (ss.pos < 0) {
+		ret = -ENXIO;
+		goto out;
+	}
+	if (ss.pos > i_size)
+		ss.pos = i_size;
+
+	if (ss.pos != file->f_pos) {
+		file->f_pos = ss.pos;
+		file->f_version = 0;
+	}
+
+out:
+	mutex_unlock(&inode->i_mutex);
+	return ret ? ret : ss.pos;
+}
+#else
+#define exofs_file_llseek generic_file_llseek
+#endif
+
 const struct file_operations exofs_file_operations = {
-	.llseek		= generic_file_llseek,
+	.llseek		= exofs_file_llseek,
 	.read		= do_sync_read,
 	.write		= do_sync_write,
 	.aio_read	= generic_file_aio_read,
@@ -88,8 +327,10 @@ const struct file_operations exofs_file_operations = {
 	.flush		= exofs_flush,
 	.splice_read	= generic_file_splice_read,
 	.splice_write	= generic_file_splice_write,
+	.fallocate	= exofs_fallocate,
 };
 
 const struct inode_operations exofs_file_inode_operations = {
 	.setattr	= exofs_setattr,
+	.fiemap		= exofs_fiemap,
 };
@@ -493,16 +493,49 @@ static void writepages_done(struct exofs_io_state *ios, void *p)
 	EXOFS_DBGMSG2("writepages_done END\n");
 }
 
+/* The deferred CREATE could not be sent. Defer it again, so the next
+ * writeback or waiter retries, and let the current waiters see that.
+ */
+static void _oi_create_unsent(struct exofs_i_info *oi)
+{
+	set_bit(OBJ_DEFER_CREATE, &oi->i_flags);
+	wake_up(&oi->i_wq);
+}
+
+/* writepages_done() of the first write of a deferred object */
+static void create_and_write_done(struct exofs_io_state *ios, void *p)
+{
+	struct page_collect *pcol = p;
+	struct exofs_i_info *oi = exofs_i(pcol->inode);
+
+	/* On error the pages report it, like create_done() we let go of the
+	 * waiters either way.
+	 */
+	set_obj_created(oi);
+	wake_up(&oi->i_wq);
+
+	writepages_done(ios, p);
+}
+
 static int write_exec(struct page_collect *pcol)
 {
 	struct exofs_i_info *oi = exofs_i(pcol->inode);
 	struct exofs_io_state *ios = pcol->ios;
 	struct page_collect *pcol_copy = NULL;
+	bool create = false;
 	int ret;
 
 	if (!pcol->pages)
 		return 0;
 
+	if (test_and_clear_bit(OBJ_DEFER_CREATE, &oi->i_flags)) {
+		create = true;
+	} else {
+		ret = wait_obj_created(oi);
+		if (unlikely(ret))
+			goto err;
+	}
+
 	pcol_copy = kmalloc(sizeof(*pcol_copy), GFP_KERNEL);
 	if (!pcol_copy) {
 		EXOFS_ERR("write_exec: Faild to kmalloc(pcol)\n");
@@ -516,7 +549,8 @@ static int write_exec(struct page_collect *pcol)
 	ios->nr_pages = pcol_copy->nr_pages;
 	ios->offset = pcol_copy->pg_first << PAGE_CACHE_SHIFT;
 	ios->length = pcol_copy->length;
-	ios->done = writepages_done;
+	ios->done = create ? create_and_write_done : writepages_done;
+	ios->create = create;
 	ios->private = pcol_copy;
 
 	ret = exofs_oi_write(oi, ios);
@@ -534,6 +568,8 @@ static int write_exec(struct page_collect *pcol)
 	return 0;
 
 err:
+	if (create)
+		_oi_create_unsent(oi);
 	_unlock_pcol_pages(pcol, ret, WRITE);
 	pcol_free(pcol);
 	kfree(pcol_copy);
@@ -561,9 +597,12 @@ static int writepage_strip(struct page *page,
 
 	BUG_ON(!PageLocked(page));
 
-	ret = wait_obj_created(oi);
-	if (unlikely(ret))
-		goto fail;
+	/* A deferred object is created by write_exec() */
+	if (!obj_create_deferred(oi)) {
+		ret = wait_obj_created(oi);
+		if (unlikely(ret))
+			goto fail;
+	}
 
 	if (page->index < end_index)
 		/* in this case, the page is within the limits of the file */
@@ -1063,14 +1102,6 @@ bad_inode:
 	return ERR_PTR(ret);
 }
 
-int __exofs_wait_obj_created(struct exofs_i_info *oi)
-{
-	if (!obj_created(oi)) {
-		BUG_ON(!obj_2bcreated(oi));
-		wait_event(oi->i_wq, obj_created(oi));
-	}
-	return unlikely(is_bad_inode(&oi->vfs_inode)) ? -EIO : 0;
-}
 /*
  * Callback function from exofs_new_inode().  The important thing is that we
  * set the obj_created flag so that other methods know that the object exists on
@@ -1105,6 +1136,68 @@ static void create_done(struct exofs_io_state *ios, void *p)
 	wake_up(&oi->i_wq);
 }
 
+/*
+ * Send the asynchronous CREATE of the inode's object on all devices
+ */
+static int _oi_create(struct exofs_i_info *oi)
+{
+	struct inode *inode = &oi->vfs_inode;
+	struct exofs_sb_info *sbi = inode->i_sb->s_fs_info;
+	struct exofs_io_state *ios;
+	int ret;
+
+	ret = exofs_get_io_state(&sbi->layout, &ios);
+	if (unlikely(ret)) {
+		EXOFS_ERR("%s: exofs_get_io_state failed\n", __func__);
+		return ret;
+	}
+
+	ios->obj.id = exofs_oi_objno(oi);
+
+	/* increment the refcount so that the inode will still be around when we
+	 * reach the callback
+	 */
+	atomic_inc(&inode->i_count);
+
+	ios->done = create_done;
+	ios->private = inode;
+	ios->cred = oi->i_cred;
+	ret = exofs_sbi_create(ios);
+	if (ret) {
+		atomic_dec(&inode->i_count);
+		exofs_put_io_state(ios);
+		return ret;
+	}
+	atomic_inc(&sbi->s_curr_pending);
+
+	return 0;
+}
+
+int __exofs_wait_obj_created(struct exofs_i_info *oi)
+{
+	for (;;) {
+		/* Someone needs the object before its first write, create
+		 * it now
+		 */
+		if (test_and_clear_bit(OBJ_DEFER_CREATE, &oi->i_flags)) {
+			int ret = _oi_create(oi);
+
+			if (unlikely(ret)) {
+				_oi_create_unsent(oi);
+				return ret;
+			}
+		}
+
+		if (obj_created(oi))
+			break;
+
+		BUG_ON(!obj_2bcreated(oi));
+		wait_event(oi->i_wq,
+			   obj_created(oi) || obj_create_deferred(oi));
+	}
+	return unlikely(is_bad_inode(&oi->vfs_inode)) ? -EIO : 0;
+}
+
 /*
  * Set up a new inode and create an object for it on the OSD
  */
@@ -1114,7 +1207,7 @@ struct inode *exofs_new_inode(struct inode *dir, int mode)
 	struct inode *inode;
 	struct exofs_i_info *oi;
 	struct exofs_sb_info *sbi;
-	struct exofs_io_state *ios;
+	struct osd_obj_id obj;
 	int ret;
 
 	sb = dir->i_sb;
@@ -1142,30 +1235,24 @@ struct inode *exofs_new_inode(struct inode *dir, int mode)
 
 	mark_inode_dirty(inode);
 
-	ret = exofs_get_io_state(&sbi->layout, &ios);
-	if (unlikely(ret)) {
-		EXOFS_ERR("exofs_new_inode: exofs_get_io_state failed\n");
-		return ERR_PTR(ret);
-	}
-
-	ios->obj.id = exofs_oi_objno(oi);
-	exofs_make_credential(oi->i_cred, &ios->obj);
+	obj.partition = sbi->layout.s_pid;
+	obj.id = exofs_oi_objno(oi);
+	exofs_make_credential(oi->i_cred, &obj);
 
-	/* increment the refcount so that the inode will still be around when we
-	 * reach the callback
+	/* When every write reaches all the devices, a new file's object is
+	 * created by its first writeback with a single CREATE_AND_WRITE.
+	 * Otherwise, or if the object is needed sooner, see
+	 * __exofs_wait_obj_created(), a CREATE is sent.
 	 */
-	atomic_inc(&inode->i_count);
+	if (S_ISREG(mode) &&
+	    (sbi->layout.s_numdevs == sbi->layout.mirrors_p1)) {
+		set_bit(OBJ_DEFER_CREATE, &oi->i_flags);
+		return inode;
+	}
 
-	ios->done = create_done;
-	ios->private = inode;
-	ios->cred = oi->i_cred;
-	ret = exofs_sbi_create(ios);
-	if (ret) {
-		atomic_dec(&inode->i_count);
-		exofs_put_io_state(ios);
+	ret = _oi_create(oi);
+	if (unlikely(ret))
 		return ERR_PTR(ret);
-	}
-	atomic_inc(&sbi->s_curr_pending);
 
 	return inode;
 }
@@ -1240,6 +1327,14 @@ static int exofs_update_inode(struct inode *inode, int do_sync)
 	} else
 		memcpy(fcb->i_data, oi->i_data, sizeof(fcb->i_data));
 
+	if (!obj_created(oi)) {
+		EXOFS_DBGMSG("!obj_created\n");
+		ret = __exofs_wait_obj_created(oi);
+		EXOFS_DBGMSG("wait_event done\n");
+		if (unlikely(ret))
+			goto free_args;
+	}
+
 	ret = exofs_get_io_state(&sbi->layout, &ios);
 	if (unlikely(ret)) {
 		EXOFS_ERR("%s: exofs_get_io_state failed.\n", __func__);
@@ -1251,13 +1346,6 @@ static int exofs_update_inode(struct inode *inode, int do_sync)
 	ios->out_attr_len = 1;
 	ios->out_attr = &attr;
 
-	if (!obj_created(oi)) {
-		EXOFS_DBGMSG("!obj_created\n");
-		BUG_ON(!obj_2bcreated(oi));
-		wait_event(oi->i_wq, obj_created(oi));
-		EXOFS_DBGMSG("wait_event done\n");
-	}
-
 	if (!do_sync) {
 		args->sbi = sbi;
 		ios->done = updatei_done;
@@ -1319,6 +1407,10 @@ void exofs_evict_inode(struct inode *inode)
 	inode->i_size = 0;
 	end_writeback(inode);
 
+	/* never written, there is no object to remove */
+	if (test_and_clear_bit(OBJ_DEFER_CREATE, &oi->i_flags))
+		return;
+
 	/* if we are deleting an obj that hasn't been created yet, wait */
 	if (!obj_created(oi)) {
 		BUG_ON(!obj_2bcreated(oi));
@@ -582,8 +582,12 @@ static int _sbi_write_mirror(struct exofs_io_state *ios, int cur_comp)
 				bio->bi_rw |= REQ_WRITE;
 			}
 
-			osd_req_write(or, &ios->obj, per_dev->offset, bio,
-				      per_dev->length);
+			if (ios->create)
+				osd_req_create_and_write(or, &ios->obj,
+					per_dev->offset, bio, per_dev->length);
+			else
+				osd_req_write(or, &ios->obj, per_dev->offset,
+					      bio, per_dev->length);
 			EXOFS_DBGMSG("write(0x%llx) offset=0x%llx "
 				      "length=0x%llx dev=%d\n",
 				     _LLU(ios->obj.id), _LLU(per_dev->offset),
@@ -703,23 +707,9 @@ int exofs_sbi_read(struct exofs_io_state *ios)
 
 int extract_attr_from_ios(struct exofs_io_state *ios, struct osd_attr *attr)
 {
-	struct osd_attr cur_attr = {.attr_page = 0}; /* start with zeros */
-	void *iter = NULL;
-	int nelem;
-
-	do {
-		nelem = 1;
-		osd_req_decode_get_attr_list(ios->per_dev[0].or,
-					     &cur_attr, &nelem, &iter);
-		if ((cur_attr.attr_page == attr->attr_page) &&
-		    (cur_attr.attr_id == attr->attr_id)) {
-			attr->len = cur_attr.len;
-			attr->val_ptr = cur_attr.val_ptr;
-			return 0;
-		}
-	} while (iter);
+	int ret = osd_req_find_get_attr(ios->per_dev[0].or, attr);
 
-	return -EIO;
+	return ret == -ENOENT ? -EIO : ret;
 }
 
 static int _truncate_mirrors(struct exofs_io_state *ios, unsigned cur_comp,
@@ -801,3 +791,367 @@ out:
 	exofs_put_io_state(ios);
 	return ret;
 }
+
+/*
+ * The number of bytes of component @comp (a group_width * group_count index,
+ * without mirrors) that come before @file_offset. This is also the component
+ * offset of the first of its bytes at or after @file_offset. (See the
+ * striping math above)
+ */
+static u64 _comp_bytes_before(struct exofs_layout *layout, unsigned comp,
+			      u64 file_offset)
+{
+	u32	stripe_unit = layout->stripe_unit;
+	u32	group_width = layout->group_width;
+	u64	group_depth = layout->group_depth;
+
+	u32	U = stripe_unit * group_width;
+	u64	T = U * group_depth;
+	u64	S = T * layout->group_count;
+	u64	M = div64_u64(file_offset, S);
+
+	u64	LmodS = file_offset - M * S;
+	u32	G = div64_u64(LmodS, T);
+	u64	H = LmodS - G * T;
+	u32	N = div_u64(H, U);
+	u32	HmodU = H - N * U;
+	unsigned col = HmodU / stripe_unit;
+
+	unsigned comp_group = comp / group_width;
+	unsigned comp_col = comp % group_width;
+	u64 bytes = M * group_depth * stripe_unit;
+
+	if (G > comp_group)
+		return bytes + group_depth * stripe_unit;
+	if (G < comp_group)
+		return bytes;
+
+	bytes += (u64)N * stripe_unit;
+	if (col > comp_col)
+		bytes += stripe_unit;
+	else if (col == comp_col)
+		bytes += HmodU - col * stripe_unit;
+
+	return bytes;
+}
+
+/*
+ * Punch (deallocate) or clear (zero) the file range on all components. A
+ * file range maps to one contiguous range on each component, so it is one
+ * command per device.
+ */
+int exofs_oi_punch(struct exofs_i_info *oi, u64 offset, u64 length,
+		   bool clear)
+{
+	struct exofs_sb_info *sbi = oi->vfs_inode.i_sb->s_fs_info;
+	struct exofs_io_state *ios;
+	unsigned comp, numcomps;
+	int ret;
+
+	if (osd_dev_is_ver1(sbi->layout.s_ods[0]))
+		return -EOPNOTSUPP;
+
+	ret = exofs_get_io_state(&sbi->layout, &ios);
+	if (unlikely(ret))
+		return ret;
+
+	ios->obj.id = exofs_oi_objno(oi);
+	ios->cred = oi->i_cred;
+	ios->numdevs = ios->layout->s_numdevs;
+
+	numcomps = ios->layout->group_width * ios->layout->group_count;
+	for (comp = 0; comp < numcomps; ++comp) {
+		u64 start = _comp_bytes_before(ios->layout, comp, offset);
+		u64 end = _comp_bytes_before(ios->layout, comp,
+					     offset + length);
+		unsigned dev = comp * ios->layout->mirrors_p1;
+		unsigned last_dev = dev + ios->layout->mirrors_p1;
+
+		if (start == end)
+			continue;
+
+		for (; dev < last_dev; ++dev) {
+			struct osd_request *or;
+
+			or = osd_start_request(exofs_ios_od(ios, dev),
+					       GFP_KERNEL);
+			if (unlikely(!or)) {
+				EXOFS_ERR("%s: osd_start_request failed\n",
+					  __func__);
+				ret = -ENOMEM;
+				goto out;
+			}
+			ios->per_dev[dev].or = or;
+
+			if (clear)
+				osd_req_clear(or, &ios->obj, start, end - start);
+			else
+				osd_req_punch(or, &ios->obj, start, end - start);
+			EXOFS_DBGMSG2("%s(0x%llx) offset=0x%llx length=0x%llx "
+				      "dev=%d\n", clear ? "clear" : "punch",
+				      _LLU(ios->obj.id), _LLU(start),
+				      _LLU(end - start), dev);
+		}
+	}
+	ret = exofs_io_execute(ios);
+
+out:
+	exofs_put_io_state(ios);
+	return ret;
+}
+
+/*
+ * READ MAP of each component, then a walk over the file range that turns
+ * the component maps back into file ranges.
+ */
+#define EXOFS_MAP_NELEM ((PAGE_SIZE - sizeof(struct osd_map_list)) / \
+			 sizeof(struct osd_map_descriptor))
+
+struct _comp_map {
+	struct _comp_extent {
+		u64 offset;
+		u64 length;
+	} *ext;			/* sorted, in component offsets */
+	unsigned n;
+	unsigned alloc;
+	unsigned cur;
+};
+
+static int _comp_map_add(struct _comp_map *cm, u64 offset, u64 length)
+{
+	if (cm->n == cm->alloc) {
+		unsigned alloc = cm->alloc ? cm->alloc * 2 : 16;
+		struct _comp_extent *ext;
+
+		ext = krealloc(cm->ext, alloc * sizeof(*ext), GFP_KERNEL);
+		if (unlikely(!ext))
+			return -ENOMEM;
+		cm->ext = ext;
+		cm->alloc = alloc;
+	}
+
+	cm->ext[cm->n].offset = offset;
+	cm->ext[cm->n].length = length;
+	cm->n++;
+	return 0;
+}
+
+static int _read_comp_map(struct exofs_io_state *ios, unsigned comp,
+			  u64 start, u64 end, struct osd_map_list *list,
+			  struct _comp_map *cm)
+{
+	u64 pos = start;
+
+	while (pos < end) {
+		struct osd_request *or;
+		unsigned total, n, i;
+		u64 next;
+		int ret;
+
+		or = osd_start_request(exofs_ios_od(ios,
+				comp * ios->layout->mirrors_p1), GFP_KERNEL);
+		if (unlikely(!or)) {
+			EXOFS_ERR("%s: osd_start_request failed\n", __func__);
+			return -ENOMEM;
+		}
+
+		ret = osd_req_read_map(or, &ios->obj, pos,
+				       OSD_MAP_WRITTEN_DATA, list,
+				       EXOFS_MAP_NELEM);
+		if (likely(!ret))
+			ret = osd_finalize_request(or, 0, ios->cred, NULL);
+		if (likely(!ret))
+			ret = osd_execute_request(or);
+		osd_end_request(or);
+		if (unlikely(ret)) {
+			EXOFS_DBGMSG("read_map(0x%llx) comp=%u => %d\n",
+				     _LLU(ios->obj.id), comp, ret);
+			return ret;
+		}
+
+		total = osd_map_list_count(list);
+		n = min_t(unsigned, total, EXOFS_MAP_NELEM);
+		if (!n)
+			break;
+
+		for (i = 0; i < n; i++) {
+			struct osd_map_descriptor *md = &list->maps[i];
+			u64 o = be64_to_cpu(md->offset);
+			u64 e = min(o + be64_to_cpu(md->length), end);
+
+			if (be16_to_cpu(md->map_type) != OSD_MAP_WRITTEN_DATA)
+				continue;
+
+			o = max(o, pos);
+			if (o >= e)
+				continue;
+
+			ret = _comp_map_add(cm, o, e - o);
+			if (unlikely(ret))
+				return ret;
+		}
+
+		if (total <= n)
+			break;
+
+		/* Truncated, continue after the last returned range */
+		next = be64_to_cpu(list->maps[n - 1].offset) +
+		       be64_to_cpu(list->maps[n - 1].length);
+		if (next <= pos)
+			break;
+		pos = next;
+	}
+
+	return 0;
+}
+
+/*
+ * The file offset of byte @comp_offset of component @comp, the inverse of
+ * _calc_stripe_info().
+ */
+static u64 _comp_to_file(struct exofs_layout *layout, unsigned comp,
+			 u64 comp_offset)
+{
+	u32	stripe_unit = layout->stripe_unit;
+	u32	group_width = layout->group_width;
+	u64	group_depth = layout->group_depth;
+
+	u32	U = stripe_unit * group_width;
+	u64	T = U * group_depth;
+	u64	S = T * layout->group_count;
+	u64	M = div64_u64(comp_offset, group_depth * stripe_unit);
+
+	u64	H = comp_offset - M * group_depth * stripe_unit;
+	u32	unit_off;
+	u64	N = div_u64_rem(H, stripe_unit, &unit_off);
+
+	return M * S + (u64)(comp / group_width) * T + N * U +
+	       (u64)(comp % group_width) * stripe_unit + unit_off;
+}
+
+/*
+ * The first file offset at or after @pos, up to @end, written on any of the
+ * components. Each component's cursor is moved past the extents before
+ * @pos, which only grows.
+ */
+static u64 _next_written(struct exofs_layout *layout, struct _comp_map *cms,
+			 unsigned numcomps, u64 pos, u64 end)
+{
+	u64 next = end;
+	unsigned comp;
+
+	for (comp = 0; comp < numcomps; ++comp) {
+		struct _comp_map *cm = &cms[comp];
+		u64 cpos = _comp_bytes_before(layout, comp, pos);
+		u64 start;
+
+		while ((cm->cur < cm->n) &&
+		       (cm->ext[cm->cur].offset + cm->ext[cm->cur].length <=
+			cpos))
+			cm->cur++;
+		if (cm->cur == cm->n)
+			continue;
+
+		start = max(cm->ext[cm->cur].offset, cpos);
+		next = min(next, _comp_to_file(layout, comp, start));
+	}
+
+	return next;
+}
+
+int exofs_oi_read_map(struct exofs_i_info *oi, u64 offset, u64 length,
+		      exofs_map_fn fn, void *priv)
+{
+	struct exofs_sb_info *sbi = oi->vfs_inode.i_sb->s_fs_info;
+	struct exofs_io_state *ios;
+	struct osd_map_list *list = NULL;
+	struct _comp_map *cms = NULL;
+	unsigned comp, numcomps, mirrors_p1;
+	u64 pos, end = offset + length;
+	u64 ext_off = 0, ext_len = 0;
+	int ret;
+
+	if (osd_dev_is_ver1(sbi->layout.s_ods[0]))
+		return -EOPNOTSUPP;
+
+	ret = exofs_get_io_state(&sbi->layout, &ios);
+	if (unlikely(ret))
+		return ret;
+
+	ios->obj.id = exofs_oi_objno(oi);
+	ios->cred = oi->i_cred;
+	mirrors_p1 = ios->layout->mirrors_p1;
+	numcomps = ios->layout->group_width * ios->layout->group_count;
+
+	list = kmalloc(PAGE_SIZE, GFP_KERNEL);
+	cms = kcalloc(numcomps, sizeof(*cms), GFP_KERNEL);
+	if (unlikely(!list || !cms)) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	for (comp = 0; comp < numcomps; ++comp) {
+		ret = _read_comp_map(ios, comp,
+			_comp_bytes_before(ios->layout, comp, offset),
+			_comp_bytes_before(ios->layout, comp, end),
+			list, &cms[comp]);
+		if (unlikely(ret))
+			goto out;
+	}
+
+	/* Walk the written ranges a stripe unit at a time, merging them, and
+	 * jump over holes to where any component is next written.
+	 */
+	for (pos = offset; pos < end;) {
+		struct _striping_info si;
+		struct _comp_map *cm;
+		struct _comp_extent *ce;
+		u64 chunk;
+
+		cond_resched();
+		_calc_stripe_info(ios, pos, &si);
+		cm = &cms[si.dev / mirrors_p1];
+		chunk = (numcomps == 1) ? end - pos :
+			min_t(u64, ios->layout->stripe_unit - si.unit_off,
+			      end - pos);
+
+		while ((cm->cur < cm->n) &&
+		       (cm->ext[cm->cur].offset + cm->ext[cm->cur].length <=
+			si.obj_offset))
+			cm->cur++;
+
+		ce = (cm->cur < cm->n) ? &cm->ext[cm->cur] : NULL;
+		if (!ce || (ce->offset > si.obj_offset)) {
+			pos = _next_written(ios->layout, cms, numcomps, pos,
+					    end);
+			continue;
+		}
+
+		chunk = min(chunk, ce->offset + ce->length - si.obj_offset);
+		if (ext_len && (ext_off + ext_len == pos)) {
+			ext_len += chunk;
+		} else {
+			if (ext_len) {
+				ret = fn(priv, ext_off, ext_len);
+				if (ret)
+					goto out;
+			}
+			ext_off = pos;
+			ext_len = chunk;
+		}
+		pos += chunk;
+	}
+
+	if (ext_len)
+		ret = fn(priv, ext_off, ext_len);
+
+out:
+	if (cms) {
+		for (comp = 0; comp < numcomps; ++comp)
+			kfree(cms[comp].ext);
+		kfree(cms);
+	}
+	kfree(list);
+	exofs_put_io_state(ios);
+	return ret < 0 ? ret : 0;
+}
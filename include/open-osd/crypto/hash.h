@@ -0,0 +1,45 @@
+/*
+ * User-mode safe <crypto/hash.h>
+ *
+ * Description: The synchronous hash (shash) API of Kernel's crypto layer.
+ *              Only "sha1" is implemented, in lib/sha1.c. Like the Kernel,
+ *              the fastest implementation the CPU supports is picked at
+ *              crypto_alloc_shash().
+ *
+ * Copyright: See COPYING file that comes with this distribution
+ *
+ */
+#ifndef __KinU_CRYPTO_HASH_H__
+#define __KinU_CRYPTO_HASH_H__
+
+#include <linux/types.h>
+#include "err.h"
+
+struct crypto_shash;
+
+struct shash_desc {
+	struct crypto_shash *tfm;
+	u32 flags;
+
+	void *__ctx[] __attribute__((aligned(sizeof(u64))));
+};
+
+static inline void *shash_desc_ctx(struct shash_desc *desc)
+{
+	return desc->__ctx;
+}
+
+struct crypto_shash *crypto_alloc_shash(const char *alg_name, u32 type,
+					u32 mask);
+void crypto_free_shash(struct crypto_shash *tfm);
+unsigned crypto_shash_descsize(struct crypto_shash *tfm);
+unsigned crypto_shash_statesize(struct crypto_shash *tfm);
+
+int crypto_shash_init(struct shash_desc *desc);
+int crypto_shash_update(struct shash_desc *desc, const u8 *data,
+			unsigned len);
+int crypto_shash_final(struct shash_desc *desc, u8 *out);
+int crypto_shash_export(struct shash_desc *desc, void *out);
+int crypto_shash_import(struct shash_desc *desc, const void *in);
+
+#endif /* ndef __KinU_CRYPTO_HASH_H__ */
@@ -0,0 +1,29 @@
+/*
+ * User-mode safe <crypto/sha.h>
+ *
+ * Description: SHA1 constants and the exported hash state
+ *
+ * Copyright: See COPYING file that comes with this distribution
+ *
+ */
+#ifndef __KinU_CRYPTO_SHA_H__
+#define __KinU_CRYPTO_SHA_H__
+
+#include <linux/types.h>
+
+#define SHA1_DIGEST_SIZE	20
+#define SHA1_BLOCK_SIZE		64
+
+#define SHA1_H0		0x67452301UL
+#define SHA1_H1		0xefcdab89UL
+#define SHA1_H2		0x98badcfeUL
+#define SHA1_H3		0x10325476UL
+#define SHA1_H4		0xc3d2e1f0UL
+
+struct sha1_state {
+	u64 count;
+	u32 state[SHA1_DIGEST_SIZE / 4];
+	u8 buffer[SHA1_BLOCK_SIZE];
+};
+
+#endif /* ndef __KinU_CRYPTO_SHA_H__ */
@@ -15,12 +15,55 @@
 
 typedef int gfp_t;
 #define GFP_KERNEL 0
+/* Unlike Kernel, waiting is the default, these only ask not to */
+#define GFP_NOWAIT 1
+#define GFP_ATOMIC GFP_NOWAIT
 
 void *kalloc(size_t size, gfp_t unused);
 void *kzalloc(size_t size, gfp_t unused);
 void *krealloc(const void *p, size_t new_size, gfp_t flags);
 void kfree(const void *objp); /*NULL safe like Kernel*/
 
+static inline void *kmalloc(size_t size, gfp_t flags)
+{
+	return kalloc(size, flags);
+}
+
+/* Object caches. kalloc() above is served from size-class caches for small
+ * sizes. Each thread allocates and frees through a private magazine of
+ * objects, and only takes the cache lock to exchange half a magazine.
+ */
+#define SLAB_HWCACHE_ALIGN	0x00002000UL
+#define SLAB_RECLAIM_ACCOUNT	0x00020000UL
+#define SLAB_MEM_SPREAD		0x00100000UL
+
+struct kmem_cache;
+
+/* NOTE: unlike Kernel @ctor is called on every allocation */
+struct kmem_cache *kmem_cache_create(const char *name, size_t size,
+				     size_t align, unsigned long flags,
+				     void (*ctor)(void *));
+void kmem_cache_destroy(struct kmem_cache *cachep);
+void *kmem_cache_alloc(struct kmem_cache *cachep, gfp_t flags);
+void *kmem_cache_zalloc(struct kmem_cache *cachep, gfp_t flags);
+void kmem_cache_free(struct kmem_cache *cachep, void *objp);
+
+/* Memory pools. A reserve of @min_nr elements is kept for when the
+ * underlying allocator fails. mempool_alloc() then waits for an element to
+ * be returned and never fails, like Kernel's with GFP_KERNEL. With
+ * GFP_NOWAIT/GFP_ATOMIC it returns NULL when the reserve is empty.
+ */
+typedef void *(mempool_alloc_t)(gfp_t gfp_mask, void *pool_data);
+typedef void (mempool_free_t)(void *element, void *pool_data);
+typedef struct mempool_s mempool_t;
+
+mempool_t *mempool_create(int min_nr, mempool_alloc_t *alloc_fn,
+			  mempool_free_t *free_fn, void *pool_data);
+mempool_t *mempool_create_slab_pool(int min_nr, struct kmem_cache *kc);
+void mempool_destroy(mempool_t *pool);
+void *mempool_alloc(mempool_t *pool, gfp_t gfp_mask);
+void mempool_free(void *element, mempool_t *pool);
+
 unsigned long __get_free_page(gfp_t unused);
 void free_page(unsigned long addr);
 
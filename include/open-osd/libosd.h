@@ -6,11 +6,68 @@
 #include <scsi/osd_attributes.h>
 #include <scsi/osd_sense.h>
 
-/* For the sake of stable ABI osd_dev is dynamical allocated by library */
+/* For the sake of stable ABI osd_dev is dynamical allocated by library.
+ * Each osd_open() returns a new osd_dev. See osduld_info_lookup() in
+ * osd_initiator.h for lookup by systemid/osdname.
+ */
 
 int osd_open(const char *osd_path, struct osd_dev **pod);
+/* Same as osd_open() but with @nr_queues bsg files for the device. Many
+ * threads may then submit concurrently, each thread using one queue.
+ */
+int osd_open_queues(const char *osd_path, unsigned nr_queues,
+		    struct osd_dev **pod);
+/* Like osd_open_queues() but the osd_dev is shared with all other shared
+ * openers of the same OSD, and reference counted. osduld_path_lookup() and
+ * osduld_info_lookup() open shared.
+ */
+int osd_open_shared(const char *osd_path, unsigned nr_queues,
+		    struct osd_dev **pod);
 void osd_close(struct osd_dev *od);
 
+/* Completion of osd_execute_request_async() requests. The done callbacks
+ * are called from the calling thread. Return number of completed requests
+ * or negative error.
+ */
+int osd_poll_completions(struct osd_dev *od, int min, int max, int timeout);
+int osd_wait_all(struct osd_dev *od);
+
+/* Between osd_plug() and osd_unplug() async requests are queued and
+ * submitted to the device in batches.
+ */
+void osd_plug(struct osd_dev *od);
+void osd_unplug(struct osd_dev *od);
+
+/* Limit the number of async requests in flight on @od to @max_depth (0 for
+ * no limit). At the limit osd_execute_request_async() blocks until a request
+ * completes, or if @nowait the request is completed right away with -EAGAIN.
+ * Done callbacks called from the reaper thread always get -EAGAIN, since
+ * only that thread could complete the request they would wait for.
+ */
+void osd_set_queue_depth(struct osd_dev *od, unsigned max_depth, bool nowait);
+
+/* Have a library thread complete async requests of @od as soon as they are
+ * done. The done callbacks are then called from that thread.
+ * Return 0 or POSIX error-code.
+ * Once osd_reaper_detach() returns, no more callbacks of @od are called by
+ * that thread. A done callback may itself osd_close() or detach a device,
+ * the detach is then deferred: callbacks of @od that were already picked
+ * up may still be called after it returns.
+ */
+int osd_reaper_attach(struct osd_dev *od);
+void osd_reaper_detach(struct osd_dev *od);
+
+/* Give an async request @msecs to complete, from now. Past it, the request
+ * is completed with -ETIMEDOUT. Call after osd_finalize_request() and
+ * before osd_execute_request_async(). 0 @msecs for no deadline.
+ */
+int osd_set_request_deadline(struct osd_request *or, unsigned msecs);
+/* Complete an in-flight async request now with -ECANCELED. Returns 0,
+ * -EALREADY if @or was already completed, or -EINVAL if @or was not given a
+ * deadline with osd_set_request_deadline() before it was executed.
+ */
+int osd_cancel_request(struct osd_request *or);
+
 /* Low level utils. Should not be needed */
 int osdpath_to_bsgpath(const char *osd_path, char *bsg_path);
 
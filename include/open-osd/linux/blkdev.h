@@ -21,17 +21,111 @@
 
 #include <string.h>
 #include <errno.h>
+#include <pthread.h>
 #include <unistd.h>
 
 #define BLK_DEFAULT_SG_TIMEOUT	(60 * HZ)
 
-struct request_queue {
+/* Max sg_io_v4 commands submitted/reaped per write()/read() */
+#define BSG_MAX_BATCH		32
+/* Max bsg files opened per request_queue */
+#define BSG_MAX_QUEUES		16
+
+/* An open bsg file, with its own submission queue flushed in one write() */
+struct bsg_queue {
 	int fd;
-	volatile int num_requests;
+	int num_requests;
+	pthread_mutex_t lock; /* protects sq */
+	void *sq; /* struct sg_io_v4[BSG_MAX_BATCH] */
+	unsigned sq_num;
+};
+
+/* Bounce buffers, when needed, are recycled per request_queue in power of 2
+ * size classes, from 4K up to 4M. Bigger ones are not cached.
+ */
+#define BSG_BOUNCE_MIN_SHIFT	12
+#define BSG_BOUNCE_CLASSES	11
+#define BSG_BOUNCE_CACHED	4 /* free buffers kept per class */
+
+struct bsg_bounce_stats {
+	unsigned long allocs;	/* bounce buffers requested */
+	unsigned long hits;	/* served from the pool */
+	unsigned long oversize;	/* too big for the pool */
+	unsigned long in_use;	/* currently held by requests */
+	unsigned long cached_bytes; /* sitting free in the pool */
+};
+
+struct bsg_bounce_pool {
+	pthread_mutex_t lock;
+	bool hugepages; /* back 2M and up classes with huge pages */
+	unsigned nr_free[BSG_BOUNCE_CLASSES];
+	void *free[BSG_BOUNCE_CLASSES][BSG_BOUNCE_CACHED];
+	struct bsg_bounce_stats stats;
+};
+
+/* Per request deadlines, in a hashed timer wheel of BSG_TW_TICK_MS ticks */
+#define BSG_TW_SLOTS		256
+#define BSG_TW_TICK_MS		10
+
+struct request;
+
+struct bsg_timer_wheel {
+	pthread_mutex_t lock;
+	u64 last_tick;
+	unsigned count;
+	struct request *slots[BSG_TW_SLOTS];
+};
+
+/* Submitting threads are spread over the bsg_queues, one queue per thread.
+ * Completions may be reaped from any thread.
+ */
+struct request_queue {
+	unsigned nr_queues;
+	struct bsg_queue queues[BSG_MAX_QUEUES];
+	int num_requests; /* all queues, updated atomically */
+	int plugged;
+	bool use_iovec; /* probed at bsg_open */
+	struct bsg_bounce_pool bounce_pool;
+
+	/* in-flight limit */
+	unsigned max_depth; /* 0 for no limit */
+	bool depth_nowait; /* -EAGAIN instead of blocking at max_depth */
+	bool reaper_attached; /* another thread reaps completions */
+	pthread_t reaper; /* that thread, valid if reaper_attached */
+	int depth_waiters;
+	pthread_mutex_t depth_lock;
+	pthread_cond_t depth_cond;
+
+	struct bsg_timer_wheel tw;
 };
 
-int bsg_open(struct request_queue *q, const char *bsg_path);
+int bsg_open(struct request_queue *q, const char *bsg_path,
+	     unsigned nr_queues);
 void bsg_close(struct request_queue* q);
+void bsg_set_queue_depth(struct request_queue *q, unsigned max_depth,
+			 bool nowait);
+void bsg_set_bounce_hugepages(struct request_queue *q, bool on);
+void bsg_get_bounce_stats(struct request_queue *q,
+			  struct bsg_bounce_stats *stats);
+int bsg_poll_completions(struct request_queue *q, int min, int max,
+			 int timeout);
+int bsg_wait_all(struct request_queue *q);
+int bsg_reap_ready(struct request_queue *q);
+
+/* A request completed early by bsg_cancel_request() or by its deadline is
+ * kept by the library until the device returns it. Only requests with a
+ * deadline can be cancelled, their data goes through bounce buffers so the
+ * device does not access the owner's buffers after completion.
+ */
+void bsg_set_deadline(struct request *rq, unsigned msecs);
+int bsg_cancel_request(struct request *rq, int error);
+int bsg_expire_deadlines(struct request_queue *q);
+
+/* While plugged, async requests accumulate and are submitted together on
+ * blk_unplug(), when BSG_MAX_BATCH is reached, or before any wait.
+ */
+void blk_plug_device(struct request_queue *q);
+void blk_unplug(struct request_queue *q);
 
 struct bio {
 	int ref;
@@ -59,6 +153,11 @@ struct page *page;
 #define offset_in_page(p) 0
 #define virt_to_page(p) ((struct page *)p)
 
+static inline void bio_get(struct bio *bio)
+{
+	bio->ref++;
+}
+
 void bio_put(struct bio *bio);
 void bio_endio(struct bio *bio, int error);
 struct bio *bio_kmalloc(gfp_t gfp_mask, int nr_iovecs);
@@ -68,9 +167,11 @@ struct bio *bio_map_kern(
 	struct request_queue *q, void *data, unsigned int len,
 			 gfp_t gfp_mask);
 
-struct request;
 typedef void (rq_end_io_fn)(struct request *, int);
 
+#define BSG_MAX_CDB		256
+#define BSG_MAX_SENSE		252
+
 struct request {
 	struct request_queue *q;
 	struct bio *bio;
@@ -96,6 +197,17 @@ struct request {
 
 	void* end_io_data;
 	rq_end_io_fn *rq_end_io;
+
+	/* async life time, deadline and cancel */
+	int ref;
+	int state;
+	u64 deadline; /* CLOCK_MONOTONIC msec, 0 for none */
+	struct request *tw_next;
+	struct request **tw_pprev;
+	struct request *cancelled_next_rq;
+	/* private copies, the owner's may be gone once cancelled */
+	u8 __cmd[BSG_MAX_CDB];
+	u8 __sense[BSG_MAX_SENSE];
 };
 
 #define REQ_QUIET	(1 << 2)
@@ -118,6 +230,8 @@ struct request *blk_make_request(struct request_queue *q, struct bio *bio,
 				 gfp_t gfp_mask);
 int blk_rq_map_kern(struct request_queue *q, struct request *rq, void *kbuf,
 		    unsigned int len, gfp_t gfp_mask);
+int blk_rq_append_bio(struct request_queue *q, struct request *rq,
+		      struct bio *bio);
 int blk_execute_rq(struct request_queue *q, void *bd_disk_unused,
 		   struct request *rq, int at_head);
 void blk_execute_rq_nowait(struct request_queue *q, void *bd_disk_unused,
@@ -0,0 +1,14 @@
+/*
+ * User-mode safe <linux/mempool.h>
+ *
+ * Description: Just include the _KinU_'s kalloc.h file
+ *
+ * Copyright: See COPYING file that comes with this distribution
+ *
+ */
+#ifndef __KinU_MEMPOOL_H__
+#define __KinU_MEMPOOL_H__
+
+#include "kalloc.h"
+
+#endif /* ndef __KinU_MEMPOOL_H__ */
@@ -0,0 +1,33 @@
+/*
+ * User-mode safe <linux/spinlock.h>
+ *
+ * Description: Kernel spinlocks emulated with pthread mutexes
+ *
+ * Copyright: See COPYING file that comes with this distribution
+ *
+ */
+#ifndef __KinU_SPINLOCK_H__
+#define __KinU_SPINLOCK_H__
+
+#include <pthread.h>
+
+typedef pthread_mutex_t spinlock_t;
+
+#define DEFINE_SPINLOCK(x)	spinlock_t x = PTHREAD_MUTEX_INITIALIZER
+
+static inline void spin_lock_init(spinlock_t *lock)
+{
+	pthread_mutex_init(lock, NULL);
+}
+
+static inline void spin_lock(spinlock_t *lock)
+{
+	pthread_mutex_lock(lock);
+}
+
+static inline void spin_unlock(spinlock_t *lock)
+{
+	pthread_mutex_unlock(lock);
+}
+
+#endif /* ndef __KinU_SPINLOCK_H__ */
@@ -85,6 +85,16 @@ enum {
 #define MODULE_LICENSE(s)
 #define EXPORT_SYMBOL(f)
 
+#define __init
+#define __exit
+/* a library's module_init/exit run at load/unload of the shared object */
+#define module_init(fn)						\
+	static void __attribute__((constructor)) __module_init_##fn(void) \
+	{ fn(); }
+#define module_exit(fn)						\
+	static void __attribute__((destructor)) __module_exit_##fn(void) \
+	{ fn(); }
+
 #define WARN_ON(condition) ({						\
 	int __ret_warn_on = !!(condition);				\
 	unlikely(__ret_warn_on);					\
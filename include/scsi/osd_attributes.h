@@ -293,8 +293,16 @@ struct attributes_access_attr {
 	struct osd_attributes_list_attrid attr_list[0];
 } __packed;
 
-/* OSD2r05: 7.1.2.21 Collections attributes page */
-/* TBD */
+/* OSD2r05: 7.1.2.21 Collections attributes page
+ * (OSD_APAGE_OBJECT_COLLECTIONS)
+ * Each attribute in the range holds the 8 byte id of a collection the user
+ * object is a member of. Setting one adds the membership, setting it to zero
+ * length removes it.
+ */
+enum {
+	OSD_ATTR_OC_COLLECTION_FIRST = 0x1,        /* 8        */
+	OSD_ATTR_OC_COLLECTION_LAST  = 0xFFFFFFFD, /* 8        */
+};
 
 /* 7.1.2.20 Root Policy/Security attributes page (OSD_APAGE_ROOT_SECURITY) */
 enum {
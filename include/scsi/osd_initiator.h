@@ -18,6 +18,7 @@
 #include "osd_types.h"
 
 #include <linux/blkdev.h>
+#include <scsi/osd_sec.h>
 #include <scsi/scsi_device.h>
 
 /* Note: "NI" in comments below means "Not Implemented yet" */
@@ -125,10 +126,11 @@ static inline bool osd_dev_is_ver1(struct osd_dev *od)
 struct osd_request;
 typedef void (osd_req_done_fn)(struct osd_request *or, void *private);
 
+/* Attribute lists up to this size are kept inside the osd_request */
+enum { OSD_REQ_INLINE_SEG_LEN = 256 };
+
 struct osd_request {
 	struct osd_cdb cdb;
-	struct osd_data_out_integrity_info out_data_integ;
-	struct osd_data_in_integrity_info in_data_integ;
 
 	struct osd_dev *osd_dev;
 	struct request *request;
@@ -137,6 +139,7 @@ struct osd_request {
 		void *buff;
 		unsigned alloc_size; /* 0 here means: don't call kfree */
 		unsigned total_bytes;
+		void *inline_buff; /* used before any allocation */
 	} cdb_cont, set_attr, enc_get_attr, get_attr;
 
 	struct _osd_io_info {
@@ -152,13 +155,37 @@ struct osd_request {
 	unsigned timeout;
 	unsigned retries;
 	unsigned sense_len;
-	u8 sense[OSD_MAX_SENSE_LEN];
 	enum osd_attributes_mode attributes_mode;
 
 	osd_req_done_fn *async_done;
 	void *async_private;
 	int async_error;
 	int req_errors;
+
+	unsigned member_attrs_max; /* see osd_req_get_member_attrs() */
+
+	/* osd_req_find_get_attr() index of returned attributes */
+	struct osd_attr *attr_table;
+	unsigned attr_table_size;
+
+	/* osd_req_prepare() template */
+	struct bio *prep_out_segs; /* mapped segments following the data */
+	struct bio *prep_in_segs;
+	u64 prep_data_len;
+	unsigned prep_get_attr_bytes;
+	bool prepared;
+	bool prep_write;
+	bool prep_has_key;
+
+	/* Keep last, not zeroed on allocation. Each is written before it is
+	 * read: the integrity infos when finalized or by the target, the key
+	 * when prep_has_key, the inline segments when a list is added.
+	 */
+	struct osd_data_out_integrity_info out_data_integ;
+	struct osd_data_in_integrity_info in_data_integ;
+	u8 prep_cap_key[OSD_SEC_CAP_KEY_LEN];
+	u8 sense[OSD_MAX_SENSE_LEN]; /* only valid up to sense_len */
+	u8 inline_segs[4][OSD_REQ_INLINE_SEG_LEN];
 };
 
 static inline bool osd_req_is_ver1(struct osd_request *or)
@@ -235,6 +262,42 @@ enum osd_req_options {
 int osd_finalize_request(struct osd_request *or,
 	u8 options, const void *cap, const u8 *cap_key);
 
+/**
+ * osd_req_prepare - Finalize a request that will be issued many times
+ *
+ * @or, @options, @cap, @cap_key: As in osd_finalize_request()
+ *
+ * Like osd_finalize_request(), but the finalized CDB and the mapped
+ * attribute and integrity segments are kept, so after execution the same
+ * command can be issued again with osd_req_rebind(), with new
+ * offset/length/data. @cap_key is copied into @or. The scatter/gather
+ * and bidi data commands cannot be prepared, -EINVAL is returned.
+ */
+int osd_req_prepare(struct osd_request *or,
+	u8 options, const void *cap, const u8 *cap_key);
+
+/**
+ * osd_req_rebind - Re-issue a prepared request with new data
+ *
+ * @or:		osd_request previously passed to osd_req_prepare() and
+ *		executed to completion.
+ * @offset:	New object offset of the command.
+ * @bio:	New data, same direction as the prepared command. NULL for
+ *		a command without data.
+ * @len:	New length of the command. When attribute segments follow the
+ *		data it may not exceed the prepared length, -EINVAL is
+ *		returned.
+ *
+ * Releases the previous block request, makes a new one of @bio followed by
+ * the kept segments, patches @offset/@len into the prepared CDB and
+ * re-signs it. The request is then ready for execution. Attribute values
+ * returned by the previous execution are lost.
+ */
+int osd_req_rebind(struct osd_request *or, u64 offset, struct bio *bio,
+	u64 len);
+int osd_req_rebind_kern(struct osd_request *or, u64 offset, void *buff,
+	u64 len);
+
 /**
  * osd_execute_request - Execute the request synchronously through block-layer
  *
@@ -377,6 +440,22 @@ void osd_req_set_partition_key(struct osd_request *or,
 	osd_id partition, u8 new_key_id[OSD_CRYPTO_KEYID_SIZE],
 	u8 seed[OSD_CRYPTO_SEED_SIZE]);/* NI */
 
+/* V2 only. Snapshot or clone all of @partition into a new partition.
+ * These are metadata operations on the target, no data is copied through
+ * the initiator. A snapshot is read-only and a clone is writable. A clone
+ * stays linked to its source until detached. Refresh brings a snapshot or
+ * clone up to date with its source.
+ */
+void osd_req_create_snapshot(struct osd_request *or, osd_id partition,
+	osd_id snap_partition);
+void osd_req_create_clone(struct osd_request *or, osd_id partition,
+	osd_id clone_partition);
+void osd_req_detach_clone(struct osd_request *or, osd_id clone_partition);
+void osd_req_refresh_snapshot_clone(struct osd_request *or,
+	osd_id partition);
+void osd_req_restore_partition_from_snapshot(struct osd_request *or,
+	osd_id partition, osd_id snap_partition);
+
 /* list all collections in the partition
  * @list header must be init to zero on first run.
  *
@@ -402,23 +481,45 @@ void osd_req_flush_partition(struct osd_request *or,
  * Collection commands
  */
 void osd_req_create_collection(struct osd_request *or,
-	const struct osd_obj_id *);/* NI */
+	const struct osd_obj_id *);
 void osd_req_remove_collection(struct osd_request *or,
-	const struct osd_obj_id *);/* NI */
+	const struct osd_obj_id *);
+
+/* V2 only. Remove all the user objects that are members of the collection.
+ * The collection itself is not removed. Objects are made members by setting
+ * an attribute in their OSD_APAGE_OBJECT_COLLECTIONS page to the collection
+ * id, see OSD_ATTR_OC_COLLECTION_FIRST.
+ */
+void osd_req_remove_member_objects(struct osd_request *or,
+	const struct osd_obj_id *);
 
 /* list all objects in the collection */
 int osd_req_list_collection_objects(struct osd_request *or,
 	const struct osd_obj_id *, osd_id initial_id,
 	struct osd_obj_id_list *list, unsigned nelem);
 
-/* V2 only filtered list of objects in the collection */
-void osd_req_query(struct osd_request *or, ...);/* NI */
+/* V2 only filtered list of objects in the collection
+ * The ids of the objects matching @criteria, all or any according to
+ * @type, are returned in @matches. Use osd_query_matches_count() after
+ * execution, if larger than @nelem the list was truncated.
+ */
+int osd_req_query(struct osd_request *or, const struct osd_obj_id *obj,
+	enum osd_query_type type, const struct osd_query_criterion *criteria,
+	unsigned ncriteria, struct osd_query_matches_list *matches,
+	unsigned nelem);
 
 void osd_req_flush_collection(struct osd_request *or,
 	const struct osd_obj_id *, enum osd_options_flush_scope_values);
 
-void osd_req_get_member_attrs(struct osd_request *or, ...);/* V2-only NI */
-void osd_req_set_member_attrs(struct osd_request *or, ...);/* V2-only NI */
+/* Get/Set attributes of all the members of a collection (V2 only)
+ * Add the attributes with osd_req_add_{get,set}_attr_list(). For get the
+ * returned list is sized for @max_members, decode it with
+ * osd_req_decode_member_attrs().
+ */
+void osd_req_get_member_attrs(struct osd_request *or,
+	const struct osd_obj_id *obj, unsigned max_members);
+void osd_req_set_member_attrs(struct osd_request *or,
+	const struct osd_obj_id *obj);
 
 /*
  * Object commands
@@ -426,18 +527,55 @@ void osd_req_set_member_attrs(struct osd_request *or, ...);/* V2-only NI */
 void osd_req_create_object(struct osd_request *or, struct osd_obj_id *);
 void osd_req_remove_object(struct osd_request *or, struct osd_obj_id *);
 
+/* Create @count (up to 0xffff) objects in @partition with target assigned
+ * ids, in one command. After execution call osd_req_decode_created_objects()
+ * for the first id, the objects are @first_id .. @first_id + @count - 1.
+ */
+int osd_req_create_objects(struct osd_request *or, osd_id partition,
+	unsigned count);
+int osd_req_decode_created_objects(struct osd_request *or, osd_id *first_id);
+
 void osd_req_write(struct osd_request *or,
 	const struct osd_obj_id *obj, u64 offset, struct bio *bio, u64 len);
 int osd_req_write_kern(struct osd_request *or,
 	const struct osd_obj_id *obj, u64 offset, void *buff, u64 len);
-void osd_req_append(struct osd_request *or,
-	const struct osd_obj_id *, struct bio *data_out);/* NI */
-void osd_req_create_write(struct osd_request *or,
-	const struct osd_obj_id *, struct bio *data_out, u64 offset);/* NI */
+/* Write @len bytes at the current end of the object, the target picks the
+ * offset so concurrent appenders need not serialize. After execution call
+ * osd_req_decode_append_offset() for the offset the data landed at.
+ */
+int osd_req_append(struct osd_request *or,
+	const struct osd_obj_id *obj, struct bio *bio, u64 len);
+int osd_req_append_kern(struct osd_request *or,
+	const struct osd_obj_id *obj, void *buff, u64 len);
+int osd_req_decode_append_offset(struct osd_request *or, u64 *offset);
+/* Create the object and write to it in one command. Attributes added with
+ * osd_req_add_{get,set}_attr_list() apply to the new object.
+ */
+void osd_req_create_and_write(struct osd_request *or,
+	const struct osd_obj_id *obj, u64 offset, struct bio *bio, u64 len);
+int osd_req_create_and_write_kern(struct osd_request *or,
+	const struct osd_obj_id *obj, u64 offset, void *buff, u64 len);
+/* V2 only. CLEAR zeroes the range keeping its space allocated, PUNCH
+ * deallocates it. In both the range reads back as zeros and the object's
+ * logical length is not changed.
+ */
 void osd_req_clear(struct osd_request *or,
-	const struct osd_obj_id *, u64 offset, u64 len);/* NI */
+	const struct osd_obj_id *, u64 offset, u64 len);
 void osd_req_punch(struct osd_request *or,
-	const struct osd_obj_id *, u64 offset, u64 len);/* V2-only NI */
+	const struct osd_obj_id *, u64 offset, u64 len);
+
+/* V2 only. Extent map of the object from @offset on, into @list with room
+ * for @nelem descriptors. READ MAP returns the ranges of map @type, READ
+ * MAPS COMPARE the ranges that differ from @other (for example the same
+ * object in a snapshot partition). Use osd_map_list_count() after
+ * execution, if larger than @nelem the list was truncated.
+ */
+int osd_req_read_map(struct osd_request *or, const struct osd_obj_id *obj,
+	u64 offset, enum osd_map_type type, struct osd_map_list *list,
+	unsigned nelem);
+int osd_req_read_maps_compare(struct osd_request *or,
+	const struct osd_obj_id *obj, const struct osd_obj_id *other,
+	u64 offset, struct osd_map_list *list, unsigned nelem);
 
 void osd_req_flush_object(struct osd_request *or,
 	const struct osd_obj_id *, enum osd_options_flush_scope_values,
@@ -490,6 +628,14 @@ int osd_req_add_set_attr_list(struct osd_request *or,
 int osd_req_add_get_attr_list(struct osd_request *or,
 	const struct osd_attr *, unsigned nelem);
 
+/*
+ * Lookup a returned attribute by @oa->attr_page/attr_id, without scanning.
+ * On success sets @oa->len and @oa->val_ptr and returns 0. -ENOENT if the
+ * attribute was not returned. The returned list is decoded once on first
+ * call. Must be called after osd_request.request was executed.
+ */
+int osd_req_find_get_attr(struct osd_request *or, struct osd_attr *oa);
+
 /*
  * Attributes list decoding
  * Must be called after osd_request.request was executed
@@ -499,6 +645,14 @@ int osd_req_add_get_attr_list(struct osd_request *or,
 int osd_req_decode_get_attr_list(struct osd_request *or,
 	struct osd_attr *, int *nelem, void **iterator);
 
+/*
+ * GET MEMBER ATTRIBUTES results decoding. Each call decodes the attributes
+ * of the next member object into @member_id and up to *@nelem @oa's.
+ * Call in a loop until *@iterator is NULL, it must start as NULL.
+ */
+int osd_req_decode_member_attrs(struct osd_request *or, osd_id *member_id,
+	struct osd_attr *oa, int *nelem, void **iterator);
+
 /* Attributes Page mode */
 
 /*
@@ -210,6 +210,9 @@ struct osd_cdb_head {
 } __packed;
 /*80*/
 
+/* CREATE: NUMBER OF USER OBJECTS (__be16), same offset in v1 and v2 */
+#define OSD_CDB_CREATE_NUM_OBJECTS_OFFSET	36
+
 /*160 v1*/
 struct osdv1_security_parameters {
 /*160*/u8	integrity_check_value[OSDv1_CRYPTO_KEYID_SIZE];
@@ -686,6 +689,94 @@ struct osd_continuation_descriptor_header {
 } __packed;
 
 
+/* osd2r05a sec 5.4.3: Query list */
+enum osd_query_type {
+	OSD_QUERY_UNION = 0x0,		/* match any criterion */
+	OSD_QUERY_INTERSECTION = 0x1,	/* match all criteria */
+};
+
+struct osd_query_list_header {
+	u8 query_type; /* low 4-bit only */
+	u8 reserved[3];
+	/* followed by struct osd_query_criterion_entry's */
+} __packed;
+
+struct osd_query_criterion_entry {
+	__be16 reserved;
+	__be16 query_entry_length; /* bytes following this field */
+	__be32 attr_page;
+	__be32 attr_id;
+	__be16 min_len;
+	/* followed by min value, __be16 max_len and max value */
+} __packed;
+
+/* osd2r04 sec 6.18.3: QUERY command matches list */
+enum {
+	OSD_QUERY_OBJ_DESC_OID = 0x21, /* object descriptor is user object ID */
+};
+
+struct osd_query_matches_list {
+	__be64 additional_length; /* bytes in list excluding this field */
+	u8 reserved[4];
+	u8 object_descriptor_format; /* upper 6-bits */
+	u8 reserved2[3];
+	__be64 object_ids[0];
+} __packed;
+
+static inline unsigned osd_query_matches_count(
+	struct osd_query_matches_list *list)
+{
+	u64 len = be64_to_cpu(list->additional_length);
+
+	if (len < sizeof(*list) - sizeof(list->additional_length))
+		return 0;
+	len -= sizeof(*list) - sizeof(list->additional_length);
+	return len / sizeof(list->object_ids[0]);
+}
+
+/* osd2r05a sec 5.4.4: User object descriptor, names the object that
+ * READ MAPS COMPARE compares against
+ */
+struct osd_user_object_continuation_descriptor {
+	struct osd_continuation_descriptor_header hdr;
+	__be64 partition_id;
+	__be64 user_object_id;
+} __packed;
+
+/* osd2r05 sec 6.23: READ MAP, and 6.24: READ MAPS COMPARE */
+enum osd_map_type {
+	OSD_MAP_WRITTEN_DATA = 0x0001,
+	OSD_MAP_DATA_NOT_WRITTEN = 0x0002,
+	OSD_MAP_DAMAGED_DATA = 0x0003,
+};
+
+/* READ MAP: REQUESTED MAP TYPE (__be16) */
+#define OSD_CDB_READ_MAP_TYPE_OFFSET	14
+
+struct osd_map_descriptor {
+	__be64 offset;
+	__be64 length;
+	__be16 map_type;
+	u8 reserved[6];
+} __packed;
+
+struct osd_map_list {
+	__be64 additional_length; /* bytes in list excluding this field */
+	__be64 key_offset; /* object offset the map starts at */
+	struct osd_map_descriptor maps[0];
+} __packed;
+
+/* Number of descriptors the target had, may be more than were returned */
+static inline unsigned osd_map_list_count(struct osd_map_list *list)
+{
+	u64 len = be64_to_cpu(list->additional_length);
+
+	if (len < sizeof(*list) - sizeof(list->additional_length))
+		return 0;
+	len -= sizeof(*list) - sizeof(list->additional_length);
+	return len / sizeof(list->maps[0]);
+}
+
 /* osd2r05a sec 5.4.2: Scatter/gather list */
 struct osd_sg_list_entry {
 	__be64 offset;
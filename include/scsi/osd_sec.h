@@ -14,6 +14,9 @@
 #ifndef __OSD_SEC_H__
 #define __OSD_SEC_H__
 
+#include <crypto/hash.h>
+#include <crypto/sha.h>
+
 #include "osd_protocol.h"
 #include "osd_types.h"
 
@@ -29,15 +32,59 @@ void osd_sec_encode_caps(void *caps, ...);/* NI */
 void osd_sec_init_nosec_doall_caps(void *caps,
 	const struct osd_obj_id *obj, bool is_collection, const bool is_v1);
 
-bool osd_is_sec_alldata(struct osd_security_parameters *sec_params);
+/* Capability keys are HMAC-SHA1 outputs */
+enum { OSD_SEC_CAP_KEY_LEN = 20 };
+
+/* Security method of the capability already set in the cdb */
+static inline u8 osd_sec_method(const struct osd_cdb *ocdb)
+{
+	/* NOTE: v1 and v2 caps start at same address */
+	const struct osd_capability_head *cap = (const void *)ocdb->v1.caps;
+
+	return cap->security_method;
+}
+
+static inline bool osd_is_sec_alldata(const struct osd_cdb *ocdb)
+{
+	return osd_sec_method(ocdb) == OSD_SEC_ALLDATA;
+}
 
 /* Conditionally sign the CDB according to security setting in ocdb
- * with cap_key */
-void osd_sec_sign_cdb(struct osd_cdb *ocdb, const u8 *cap_key);
+ * with cap_key. The request integrity check value is the HMAC-SHA1 of the
+ * whole CDB, computed with that field zeroed.
+ */
+int osd_sec_sign_cdb(struct osd_cdb *ocdb, const u8 *cap_key, bool is_v1);
 
-/* Unconditionally sign the BIO data with cap_key.
+/* Unconditionally sign the first @len bytes of the BIO chain with cap_key.
+ * The SHA1_DIGEST_SIZE bytes integrity check value is written to
+ * @data_integ, the rest of a longer (v2) field is left as is.
  * Check for osd_is_sec_alldata() was done prior to calling this. */
-void osd_sec_sign_data(void *data_integ, struct bio *bio, const u8 *cap_key);
+int osd_sec_sign_data(void *data_integ, struct bio *bio, u64 len,
+	const u8 *cap_key);
+
+/* Incremental HMAC-SHA1 with a capability key. Buffers and BIO chains are
+ * hashed in place, segment by segment, nothing is linearized. The digest
+ * lives on the caller's stack, only the "sha1" tfm is shared.
+ * osd_sec_digest_update_bio() hashes the first @len bytes of the chain and
+ * fails if it is shorter. osd_sec_digest_final() writes SHA1_DIGEST_SIZE
+ * bytes.
+ */
+struct osd_sec_digest {
+	struct shash_desc shash;
+	char ctx[sizeof(struct sha1_state)];
+	struct sha1_state opad;
+};
+
+int osd_sec_digest_init(struct osd_sec_digest *dg, const u8 *cap_key);
+int osd_sec_digest_update(struct osd_sec_digest *dg, const void *buff,
+	u64 len);
+int osd_sec_digest_update_bio(struct osd_sec_digest *dg, struct bio *bio,
+	u64 len);
+int osd_sec_digest_final(struct osd_sec_digest *dg, u8 *icv);
+
+/* libosd module init/exit */
+int osd_sec_init(void);
+void osd_sec_exit(void);
 
 /* Version independent copy of caps into the cdb */
 void osd_set_caps(struct osd_cdb *cdb, const void *caps);
@@ -42,4 +42,16 @@ struct osd_sg_entry {
 	u64 len;
 };
 
+/* A QUERY criterion, matches if min_val <= attribute <= max_val. A zero
+ * length bound is not checked. Values are in network order.
+ */
+struct osd_query_criterion {
+	u32 attr_page;
+	u32 attr_id;
+	u16 min_len;
+	u16 max_len;
+	const void *min_val;
+	const void *max_val;
+};
+
 #endif /* ndef __OSD_TYPES_H__ */
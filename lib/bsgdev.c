@@ -39,16 +39,23 @@
  */
 
 #include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <stdlib.h>
+#include <pthread.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <time.h>
 
 #include <linux/blkdev.h>
 #include <linux/bsg.h>
+#include <scsi/scsi.h>
 #include <scsi/sg.h>
 
-static int _queue_num_requests(struct request_queue* q);
-static int _bsg_wait_response(struct request_queue* q);
+static void _bounce_pool_init(struct bsg_bounce_pool *pool);
+static void _bounce_pool_destroy(struct bsg_bounce_pool *pool);
 
 #ifdef CONFIG_SCSI_OSD_DEBUG
 #  define bsg_dbg printf
@@ -85,50 +92,253 @@ bsg_error_errno(const char *fmt, ...)
 	fprintf(stderr, ": %s.\n", strerror(errno));
 }
 
-int __g_using_iovec = 0;
+static void _bsg_queue_close(struct bsg_queue *bq)
+{
+	if (bq->fd >= 0)
+		close(bq->fd);
+	bq->fd = -1;
+	kfree(bq->sq);
+	bq->sq = NULL;
+	pthread_mutex_destroy(&bq->lock);
+}
+
+static int _bsg_queue_open(struct bsg_queue *bq, const char *bsg_path)
+{
+	bq->fd = -1;
+	pthread_mutex_init(&bq->lock, NULL);
+	bq->sq = kalloc(BSG_MAX_BATCH * sizeof(struct sg_io_v4), 0);
+	if (!bq->sq)
+		return ENOMEM;
+
+	/* Blocking is done with poll() so we can reap many per read() */
+	bq->fd = open(bsg_path, O_RDWR | O_NONBLOCK);
+	if (bq->fd < 0)
+		return errno;
+
+	return 0;
+}
+
+/*
+ * Some bsg drivers do not support sg_io_v4 iovecs, and take dxferp as a
+ * linear buffer. Read an INQUIRY into two vectors and check that the data
+ * landed in the vectors and not over the iovec array.
+ */
+static bool _bsg_probe_iovec(struct bsg_queue *bq)
+{
+	u8 cdb[6] = {INQUIRY, 0, 0, 0, 36, 0};
+	u8 sense[96];
+	u8 buf0[8], buf1[28];
+	union {
+		struct sg_iovec v[2];
+		u8 pad[64]; /* in case INQUIRY data is written here */
+	} iov;
+	struct sg_io_v4 sg;
+
+	memset(buf0, 0xff, sizeof(buf0));
+	memset(&iov, 0, sizeof(iov));
+	iov.v[0].iov_base = buf0;
+	iov.v[0].iov_len = sizeof(buf0);
+	iov.v[1].iov_base = buf1;
+	iov.v[1].iov_len = sizeof(buf1);
+
+	memset(&sg, 0, sizeof(sg));
+	sg.guard = 'Q';
+	sg.request_len = sizeof(cdb);
+	sg.request = (uint64_t) (unsigned long) cdb;
+	sg.max_response_len = sizeof(sense);
+	sg.response = (uint64_t) (unsigned long) sense;
+	sg.din_xferp = (uint64_t) (unsigned long) &iov;
+	sg.din_xfer_len = sizeof(buf0) + sizeof(buf1);
+	sg.din_iovec_count = 2;
+	sg.timeout = 10000;
+
+	if (ioctl(bq->fd, SG_IO, &sg) ||
+	    sg.device_status || sg.transport_status || sg.driver_status)
+		return false;
+
+	return (iov.v[0].iov_base == buf0) && (iov.v[1].iov_base == buf1) &&
+	       (buf0[0] != 0xff);
+}
 
-int bsg_open(struct request_queue *q, const char *bsg_path)
+static void _bsg_fini(struct request_queue *q)
+{
+	_bounce_pool_destroy(&q->bounce_pool);
+	pthread_cond_destroy(&q->depth_cond);
+	pthread_mutex_destroy(&q->depth_lock);
+	pthread_mutex_destroy(&q->tw.lock);
+}
+
+/*
+ * Open @nr_queues files on @bsg_path. Each submitting thread sticks to one
+ * of them, so threads do not contend on the same submission queue.
+ */
+int bsg_open(struct request_queue *q, const char *bsg_path,
+	     unsigned nr_queues)
 {
 	int ret = 0;
 
-	q->fd = open(bsg_path, O_RDWR);
-	if (q->fd < 0)
-		ret = errno;
+	memset(q, 0, sizeof(*q));
+	_bounce_pool_init(&q->bounce_pool);
+	pthread_mutex_init(&q->depth_lock, NULL);
+	pthread_cond_init(&q->depth_cond, NULL);
+	pthread_mutex_init(&q->tw.lock, NULL);
+	if (!nr_queues)
+		nr_queues = 1;
+	if (nr_queues > BSG_MAX_QUEUES)
+		nr_queues = BSG_MAX_QUEUES;
+
+	for (; q->nr_queues < nr_queues; ++q->nr_queues) {
+		struct bsg_queue *bq = &q->queues[q->nr_queues];
+
+		ret = _bsg_queue_open(bq, bsg_path);
+		if (unlikely(ret)) {
+			_bsg_queue_close(bq);
+			goto err;
+		}
+	}
+
+	q->use_iovec = _bsg_probe_iovec(&q->queues[0]);
+
+	bsg_dbg("bsg_open(%s, %u) => %d use_iovec=%d\n", bsg_path, nr_queues,
+		ret, q->use_iovec);
+	return ret;
 
-	bsg_dbg("bsg_open(%s) => (%d, %d)\n", bsg_path, q->fd, ret);
+err:
+	/* nothing was submitted yet */
+	while (q->nr_queues)
+		_bsg_queue_close(&q->queues[--q->nr_queues]);
+	_bsg_fini(q);
 	return ret;
 }
 
 void bsg_close(struct request_queue* q)
 {
-	bsg_dbg("bsg_close(%d)\n", q->fd);
+	unsigned i;
+
+	bsg_dbg("bsg_close(%u)\n", q->nr_queues);
 
-	if (q->fd < 0)
+	if (!q->nr_queues)
 		return;
 
-	while(_queue_num_requests(q))
-		_bsg_wait_response(q);
+	bsg_wait_all(q);
 
-	close(q->fd);
-	q->fd = -1;
+	for (i = 0; i < q->nr_queues; i++)
+		_bsg_queue_close(&q->queues[i]);
+	q->nr_queues = 0;
+	_bsg_fini(q);
 }
 
-static inline void _queue_inc_requests(struct request_queue* q)
+void bsg_set_queue_depth(struct request_queue *q, unsigned max_depth,
+			 bool nowait)
 {
-	++q->num_requests;
+	q->max_depth = max_depth;
+	q->depth_nowait = nowait;
 }
 
-static inline void _queue_dec_requests(struct request_queue* q)
+static int _queue_num_requests(struct request_queue* q)
 {
-	if (q->num_requests > 0)
-		--q->num_requests;
-	else
+	return q->num_requests;
+}
+
+static inline bool _queue_try_reserve(struct request_queue *q)
+{
+	int n = q->num_requests;
+
+	return ((unsigned)n < q->max_depth) &&
+	       __sync_bool_compare_and_swap(&q->num_requests, n, n + 1);
+}
+
+/*
+ * Take an in-flight slot of @q, waiting for completions if at max_depth.
+ * When no reaper thread is attached, the caller reaps completions itself.
+ * The reaper thread, resubmitting from a done callback, never waits on
+ * itself. It gets -EAGAIN.
+ */
+static int _queue_reserve(struct request_queue *q)
+{
+	int ret;
+
+	if (!q->max_depth) {
+		__sync_add_and_fetch(&q->num_requests, 1);
+		return 0;
+	}
+
+	while (!_queue_try_reserve(q)) {
+		if ((unsigned)_queue_num_requests(q) < q->max_depth)
+			continue; /* lost a race, retry */
+
+		if (q->depth_nowait)
+			return -EAGAIN;
+
+		if (!q->reaper_attached) {
+			ret = bsg_poll_completions(q, 1, 0, -1);
+			if (unlikely(ret < 0))
+				return ret;
+			continue;
+		}
+
+		if (pthread_equal(pthread_self(), q->reaper))
+			return -EAGAIN;
+
+		pthread_mutex_lock(&q->depth_lock);
+		__sync_add_and_fetch(&q->depth_waiters, 1);
+		while ((unsigned)_queue_num_requests(q) >= q->max_depth)
+			pthread_cond_wait(&q->depth_cond, &q->depth_lock);
+		__sync_sub_and_fetch(&q->depth_waiters, 1);
+		pthread_mutex_unlock(&q->depth_lock);
+	}
+
+	return 0;
+}
+
+/* Requests may be completed from a different thread then submitted */
+static inline void _queue_inc_requests(struct bsg_queue *bq)
+{
+	__sync_add_and_fetch(&bq->num_requests, 1);
+}
+
+static inline void _queue_dec_requests(struct request_queue* q,
+				       struct bsg_queue *bq)
+{
+	if (__sync_sub_and_fetch(&bq->num_requests, 1) < 0) {
+		__sync_add_and_fetch(&bq->num_requests, 1);
 		bsg_error("_queue_dec_requests counter below zero");
+		return;
+	}
+	__sync_sub_and_fetch(&q->num_requests, 1);
+
+	if (q->depth_waiters) {
+		pthread_mutex_lock(&q->depth_lock);
+		pthread_cond_broadcast(&q->depth_cond);
+		pthread_mutex_unlock(&q->depth_lock);
+	}
 }
 
-static int _queue_num_requests(struct request_queue* q)
+/* Threads are assigned a queue index round robin, on first submission */
+static pthread_key_t g_queue_id_key;
+static pthread_once_t g_queue_id_once = PTHREAD_ONCE_INIT;
+static unsigned g_next_queue_id;
+
+static void _queue_id_key_create(void)
 {
-	return q->num_requests;
+	pthread_key_create(&g_queue_id_key, NULL);
+}
+
+static struct bsg_queue *_this_thread_queue(struct request_queue *q)
+{
+	unsigned long id;
+
+	if (q->nr_queues == 1)
+		return &q->queues[0];
+
+	pthread_once(&g_queue_id_once, _queue_id_key_create);
+	id = (unsigned long)pthread_getspecific(g_queue_id_key);
+	if (unlikely(!id)) {
+		id = __sync_add_and_fetch(&g_next_queue_id, 1);
+		pthread_setspecific(g_queue_id_key, (void *)id);
+	}
+
+	return &q->queues[(id - 1) % q->nr_queues];
 }
 
 static struct bio *__new_bio(unsigned max_vecs)
@@ -162,16 +372,17 @@ struct bio *bio_kmalloc(gfp_t gfp_mask __unused, int nr_iovecs)
 
 int bio_add_pc_page(struct request_queue *q __unused,
 		    struct bio *bio, struct page *page, unsigned len,
-		    unsigned offset __unused)
+		    unsigned offset)
 {
-	if (bio->bi_max_vecs >= bio->bi_vecs)
+	if (bio->bi_vecs >= bio->bi_max_vecs)
 		return 0;
 
-	bio->bi_vec[bio->bi_vecs].mem = page;
+	bio->bi_vec[bio->bi_vecs].mem = (u8 *)page + offset;
 	bio->bi_vec[bio->bi_vecs].len = len;
 	bio->bi_size += len;
 
 	bio->bi_vecs++;
+	return len;
 }
 
 struct bio *bio_map_kern(struct request_queue *q __unused,
@@ -192,7 +403,6 @@ struct bio *bio_map_kern(struct request_queue *q __unused,
 
 static int __bio_append(struct bio *first, struct bio *bio)
 {
-	first->bi_size += bio->bi_size;
 	while(first->bi_next)
 		first = first->bi_next;
 
@@ -266,32 +476,180 @@ static void copy_buff_to_bios(void *buff, struct bio *bio)
 	}
 }
 
-/* must be called before total_len & iovec_count */
-static inline void *_rq_buff(struct request *rq)
+/*
+ * Bounce buffer pool
+ */
+#define BSG_BOUNCE_ALIGN	(1UL << BSG_BOUNCE_MIN_SHIFT)
+#define BSG_BOUNCE_HUGE_SHIFT	21 /* 2M */
+
+static inline size_t _bounce_class_size(int c)
+{
+	return 1UL << (BSG_BOUNCE_MIN_SHIFT + c);
+}
+
+static inline bool _bounce_class_is_huge(int c)
+{
+	return BSG_BOUNCE_MIN_SHIFT + c >= BSG_BOUNCE_HUGE_SHIFT;
+}
+
+/* returns -1 if @len is too big for the pool */
+static int _bounce_class(size_t len)
+{
+	int c;
+
+	for (c = 0; c < BSG_BOUNCE_CLASSES; c++)
+		if (len <= _bounce_class_size(c))
+			return c;
+	return -1;
+}
+
+static void _bounce_pool_init(struct bsg_bounce_pool *pool)
+{
+	pthread_mutex_init(&pool->lock, NULL);
+}
+
+/* Big classes are mmap'ed so they can be backed by huge pages */
+static void *_bounce_new(struct bsg_bounce_pool *pool, int c)
+{
+	size_t size = _bounce_class_size(c);
+	void *buf;
+
+	if (_bounce_class_is_huge(c)) {
+		buf = MAP_FAILED;
+		if (pool->hugepages)
+			buf = mmap(NULL, size, PROT_READ | PROT_WRITE,
+				   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB,
+				   -1, 0);
+		if (buf == MAP_FAILED)
+			buf = mmap(NULL, size, PROT_READ | PROT_WRITE,
+				   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		return buf == MAP_FAILED ? NULL : buf;
+	}
+
+	if (posix_memalign(&buf, BSG_BOUNCE_ALIGN, size))
+		return NULL;
+	return buf;
+}
+
+static void _bounce_delete(void *buf, int c)
+{
+	if (c >= 0 && _bounce_class_is_huge(c))
+		munmap(buf, _bounce_class_size(c));
+	else
+		free(buf);
+}
+
+static void _bounce_pool_destroy(struct bsg_bounce_pool *pool)
+{
+	int c;
+
+	for (c = 0; c < BSG_BOUNCE_CLASSES; c++)
+		while (pool->nr_free[c])
+			_bounce_delete(pool->free[c][--pool->nr_free[c]], c);
+	pool->stats.cached_bytes = 0;
+	pthread_mutex_destroy(&pool->lock);
+}
+
+static void *_bounce_get(struct request_queue *q, size_t len)
+{
+	struct bsg_bounce_pool *pool = &q->bounce_pool;
+	int c = _bounce_class(len);
+	void *buf = NULL;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->stats.allocs++;
+	if (c < 0) {
+		pool->stats.oversize++;
+	} else if (pool->nr_free[c]) {
+		buf = pool->free[c][--pool->nr_free[c]];
+		pool->stats.hits++;
+		pool->stats.cached_bytes -= _bounce_class_size(c);
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	if (!buf) {
+		if (c >= 0)
+			buf = _bounce_new(pool, c);
+		else if (posix_memalign(&buf, BSG_BOUNCE_ALIGN, len))
+			buf = NULL;
+		if (unlikely(!buf))
+			return NULL;
+	}
+
+	__sync_add_and_fetch(&pool->stats.in_use, 1);
+	return buf;
+}
+
+static void _bounce_put(struct request_queue *q, void *buf, size_t len)
+{
+	struct bsg_bounce_pool *pool = &q->bounce_pool;
+	int c = _bounce_class(len);
+
+	__sync_sub_and_fetch(&pool->stats.in_use, 1);
+
+	if (c >= 0) {
+		pthread_mutex_lock(&pool->lock);
+		if (pool->nr_free[c] < BSG_BOUNCE_CACHED) {
+			pool->free[c][pool->nr_free[c]++] = buf;
+			pool->stats.cached_bytes += _bounce_class_size(c);
+			buf = NULL;
+		}
+		pthread_mutex_unlock(&pool->lock);
+	}
+
+	if (buf)
+		_bounce_delete(buf, c);
+}
+
+void bsg_set_bounce_hugepages(struct request_queue *q, bool on)
+{
+	q->bounce_pool.hugepages = on;
+}
+
+void bsg_get_bounce_stats(struct request_queue *q,
+			  struct bsg_bounce_stats *stats)
+{
+	pthread_mutex_lock(&q->bounce_pool.lock);
+	*stats = q->bounce_pool.stats;
+	pthread_mutex_unlock(&q->bounce_pool.lock);
+}
+
+/* must be called before total_len & iovec_count
+ * @must_bounce: a request that might expire, so the device must not touch
+ * the caller's buffers once it was completed.
+ */
+static inline void *_rq_buff(struct request *rq, bool must_bounce)
 {
 	rq->__data_len = _count_vects(rq->bio, &rq->iovec_num);
 
 	if (!rq->__data_len)
 		return NULL;
 
-	if(__g_using_iovec) {
-		rq->iovec = kalloc(rq->iovec_num * sizeof(struct sg_iovec), 0);
-		if (!rq->iovec)
-			return NULL;/*ERR_PTR(-ENOMEM)*/
+	if (must_bounce)
+		goto bounce;
 
-		copy_bios_to_iovec(rq->bio, rq->iovec);
-		bsg_dbg("__g_using_iovec %u\n", rq->iovec_num);
-		return rq->iovec;
-	} else if(rq->iovec_num == 1){
+	if(rq->iovec_num == 1){
 		rq->bounce = rq->bio->bi_vec[0].mem;
 		rq->iovec_num = 0;
 		bsg_dbg("rq->iovec_num == 1 %p %u\n", rq->bounce, rq->__data_len);
-	} else {
-		rq->bounce = kalloc(rq->__data_len, 0);
-		if (_rq_is_write(rq))
-			copy_bios_to_buff(rq->bio, rq->bounce);
-		bsg_dbg("bounce %p %u\n", rq->bounce, rq->__data_len);
+		return rq->bounce;
 	}
+
+	if (rq->q->use_iovec) {
+		rq->iovec = kalloc(rq->iovec_num * sizeof(struct sg_iovec), 0);
+		if (rq->iovec) {
+			copy_bios_to_iovec(rq->bio, rq->iovec);
+			bsg_dbg("use_iovec %u\n", rq->iovec_num);
+			return rq->iovec;
+		}
+		/* else fall back to bounce */
+	}
+
+bounce:
+	rq->bounce = _bounce_get(rq->q, rq->__data_len);
+	if (rq->bounce && _rq_is_write(rq))
+		copy_bios_to_buff(rq->bio, rq->bounce);
+	bsg_dbg("bounce %p %u\n", rq->bounce, rq->__data_len);
 	return rq->bounce;
 }
 
@@ -305,32 +663,54 @@ static inline unsigned _rq_iovec_count(struct request *rq)
 	return rq->bounce ? 0 : rq->iovec_num;
 }
 
+static struct kmem_cache *g_request_cachep;
+static pthread_once_t g_request_cache_once = PTHREAD_ONCE_INIT;
+
+static void _request_cache_init(void)
+{
+	g_request_cachep = kmem_cache_create("bsg_request",
+					     sizeof(struct request), 0, 0,
+					     NULL);
+}
+
 struct request *blk_get_request(struct request_queue *q, int rw, gfp_t gfp)
 {
-	struct request * rq = kzalloc(sizeof(struct request), gfp);
+	struct request * rq;
 
-	// ref counting??
+	pthread_once(&g_request_cache_once, _request_cache_init);
+	if (unlikely(!g_request_cachep))
+		return NULL;
+
+	rq = kmem_cache_zalloc(g_request_cachep, gfp);
+	if (unlikely(!rq))
+		return NULL;
+
+	rq->ref = 1;
 	rq->q = q;
 	rq->rw = rw;
 	return rq;
 }
 
-static void _blk_end_request(struct request *rq, int error)
+static void _rq_put_bounce(struct request *rq, bool copy)
 {
-	struct bio *bio;
-
-	if (rq->next_rq)
-		_blk_end_request(rq->next_rq, error);
-
 	if(rq->bounce && rq->iovec_num) {
-		if (!_rq_is_write(rq) && !error)
+		if (copy && !_rq_is_write(rq))
 			copy_buff_to_bios(rq->bounce, rq->bio);
-		kfree(rq->bounce);
+		_bounce_put(rq->q, rq->bounce, rq->__data_len);
 	}
 	rq->bounce = NULL;
+}
 
+/* A queued, not yet written, sg_io_v4 still points at the iovec */
+static void _rq_put_iovec(struct request *rq)
+{
 	kfree(rq->iovec);
 	rq->iovec = NULL;
+}
+
+static void _rq_end_bios(struct request *rq)
+{
+	struct bio *bio;
 
 	while ((bio = rq->bio) != NULL) {
 		rq->bio = bio->bi_next;
@@ -338,6 +718,16 @@ static void _blk_end_request(struct request *rq, int error)
 	}
 }
 
+static void _blk_end_request(struct request *rq, int error)
+{
+	if (rq->next_rq)
+		_blk_end_request(rq->next_rq, error);
+
+	_rq_put_bounce(rq, !error);
+	_rq_put_iovec(rq);
+	_rq_end_bios(rq);
+}
+
 int blk_end_request(struct request *rq, int error,
 		    unsigned int nr_bytes __unused)
 {
@@ -347,12 +737,15 @@ int blk_end_request(struct request *rq, int error,
 
 void blk_put_request(struct request *rq)
 {
-	// ref counting??
-	kfree(rq);
+	/* a cancelled request is held until bsg returns it */
+	if (__sync_sub_and_fetch(&rq->ref, 1) > 0)
+		return;
+
+	kmem_cache_free(g_request_cachep, rq);
 }
 
-static int blk_rq_append_bio(struct request_queue *q __unused,
-			     struct request *rq, struct bio *bio)
+int blk_rq_append_bio(struct request_queue *q __unused,
+		      struct request *rq, struct bio *bio)
 {
 	int ret;
 
@@ -367,7 +760,7 @@ static int blk_rq_append_bio(struct request_queue *q __unused,
 	} else
 		ret = __bio_append(rq->bio, bio);
 
-	rq->__data_len = rq->bio->bi_size;
+	rq->__data_len += bio->bi_size;
 	return ret;
 }
 
@@ -407,132 +800,635 @@ static void __end_io(struct request *rq, struct sg_io_v4 *sg)
 	rq->errors = (sg->device_status << 1) | (sg->transport_status << 16) |
 			(sg->driver_status << 24);
 	rq->sense_len = sg->response_len;
+	if (rq->sense && rq->sense_len)
+		memcpy(rq->sense, rq->__sense, rq->sense_len);
 }
 
-static int _bsg_submit_request(struct request_queue *q, struct request *rq,
-				bool sync)
+static void _bsg_prep_sg(struct request_queue *q, struct request *rq,
+			 struct sg_io_v4 *sg)
 {
-	int ret;
-	struct sg_io_v4 sg;
 	struct request *read_rq = NULL;
 
-	memset(&sg, 0, sizeof(sg));
-	sg.guard = 'Q';
-	sg.request_len = rq->cmd_len;
-	sg.request = (uint64_t) (unsigned long) rq->cmd;
-	sg.max_response_len = 260;
-	sg.response = (uint64_t) (unsigned long) rq->sense;
+	memset(sg, 0, sizeof(*sg));
+	sg->guard = 'Q';
+	sg->request_len = rq->cmd_len;
+	sg->request = (uint64_t) (unsigned long) rq->cmd;
+	sg->max_response_len = sizeof(rq->__sense);
+	sg->response = (uint64_t) (unsigned long) rq->__sense;
 
 	if (_rq_is_write(rq)) {
-		sg.dout_xferp = (uint64_t) (unsigned long) _rq_buff(rq);
-		sg.dout_xfer_len = _rq_total_len(rq);
-		sg.dout_iovec_count = _rq_iovec_count(rq);
+		sg->dout_xferp = (uint64_t) (unsigned long)
+					_rq_buff(rq, rq->deadline != 0);
+		sg->dout_xfer_len = _rq_total_len(rq);
+		sg->dout_iovec_count = _rq_iovec_count(rq);
 		read_rq = rq->next_rq;
 		bsg_dbg("Has write(%p %u %u %p)\n",
-			(void*)sg.dout_xferp, sg.dout_xfer_len,
-			sg.dout_iovec_count, read_rq);
+			(void*)sg->dout_xferp, sg->dout_xfer_len,
+			sg->dout_iovec_count, read_rq);
 	} else if(rq->bio)
 		read_rq = rq;
 
 	if(read_rq) {
-		sg.din_xferp = (uint64_t) (unsigned long)_rq_buff(read_rq);
-		sg.din_xfer_len = _rq_total_len(read_rq);
-		sg.din_iovec_count = _rq_iovec_count(read_rq);
+		sg->din_xferp = (uint64_t) (unsigned long)_rq_buff(read_rq, rq->deadline != 0);
+		sg->din_xfer_len = _rq_total_len(read_rq);
+		sg->din_iovec_count = _rq_iovec_count(read_rq);
 		bsg_dbg("Has read(%p %u %u)\n",
-			(void*)sg.din_xferp, sg.din_xfer_len,
-			sg.din_iovec_count);
+			(void*)sg->din_xferp, sg->din_xfer_len,
+			sg->din_iovec_count);
 	}
 
 
-	sg.timeout = rq->timeout * 1000 / HZ;
+	sg->timeout = rq->timeout * 1000 / HZ;
 /*	rq->timeout = (hdr->timeout * HZ) / 1000;
 */
 	rq->q = q;
-	sg.usr_ptr = (uint64_t) (unsigned long)rq;
-	sg.flags = BSG_FLAG_Q_AT_TAIL;
+	sg->usr_ptr = (uint64_t) (unsigned long)rq;
+	sg->flags = BSG_FLAG_Q_AT_TAIL;
+}
 
-	if (sync){
-		ret = ioctl(q->fd, SG_IO, &sg);
-		__end_io(rq, &sg);
-		bsg_dbg("ioctl(%d,SG_IO) => %d\n", q->fd, ret);
-		if (likely(!ret && !rq->errors))
-			return 0;
-		goto error;
+/*
+ * Deadlines and cancel.
+ * An async request is BSG_RQ_INFLIGHT until either bsg returns it
+ * (BSG_RQ_DONE) or it is cancelled/expired (BSG_RQ_CANCELLED). The timer
+ * wheel lists are protected by tw.lock, the state by atomic cmpxchg.
+ */
+enum {
+	BSG_RQ_IDLE = 0,
+	BSG_RQ_INFLIGHT,
+	BSG_RQ_DONE,
+	BSG_RQ_CANCELLED,
+};
+
+static u64 _now_msec(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (u64)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+static inline bool _rq_set_state(struct request *rq, int state)
+{
+	return __sync_bool_compare_and_swap(&rq->state, BSG_RQ_INFLIGHT,
+					    state);
+}
+
+/* Called with tw->lock held */
+static void _tw_add(struct bsg_timer_wheel *tw, struct request *rq)
+{
+	u64 tick = rq->deadline / BSG_TW_TICK_MS;
+	struct request **slot;
+
+	/* already due, where the next bsg_expire_deadlines() starts */
+	if (tick < tw->last_tick)
+		tick = tw->last_tick;
+	slot = &tw->slots[tick % BSG_TW_SLOTS];
+
+	rq->tw_next = *slot;
+	if (rq->tw_next)
+		rq->tw_next->tw_pprev = &rq->tw_next;
+	*slot = rq;
+	rq->tw_pprev = slot;
+	tw->count++;
+}
+
+/* Called with tw->lock held */
+static void _tw_del(struct bsg_timer_wheel *tw, struct request *rq)
+{
+	if (!rq->tw_pprev)
+		return;
+
+	*rq->tw_pprev = rq->tw_next;
+	if (rq->tw_next)
+		rq->tw_next->tw_pprev = rq->tw_pprev;
+	rq->tw_next = NULL;
+	rq->tw_pprev = NULL;
+	tw->count--;
+}
+
+static void _rq_arm(struct request_queue *q, struct request *rq)
+{
+	rq->state = BSG_RQ_INFLIGHT;
+	if (!rq->deadline)
+		return;
+
+	pthread_mutex_lock(&q->tw.lock);
+	_tw_add(&q->tw, rq);
+	pthread_mutex_unlock(&q->tw.lock);
+}
+
+static void _rq_disarm(struct request_queue *q, struct request *rq)
+{
+	if (!rq->deadline)
+		return;
+
+	pthread_mutex_lock(&q->tw.lock);
+	_tw_del(&q->tw, rq);
+	pthread_mutex_unlock(&q->tw.lock);
+}
+
+/*
+ * Hold @rq, and its bidi read half, for the device. The references must be
+ * taken before @rq is switched to BSG_RQ_CANCELLED, since from then on a
+ * completing thread drops them in _rq_cancel_done().
+ */
+static void _rq_hold(struct request *rq)
+{
+	__sync_add_and_fetch(&rq->ref, 1);
+	if (rq->next_rq) {
+		__sync_add_and_fetch(&rq->next_rq->ref, 1);
+		rq->cancelled_next_rq = rq->next_rq;
 	}
+}
+
+/* Lost the race to a completion, or to another cancel */
+static void _rq_unhold(struct request *rq)
+{
+	if (rq->next_rq)
+		blk_put_request(rq->next_rq);
+	blk_put_request(rq);
+}
+
+static bool _rq_try_cancel(struct request *rq)
+{
+	_rq_hold(rq);
+	if (_rq_set_state(rq, BSG_RQ_CANCELLED))
+		return true;
+
+	_rq_unhold(rq);
+	return false;
+}
+
+/*
+ * Complete @rq to its owner before the device is done with it. @rq, the
+ * bounce buffers the device may still write to and the iovec a plugged
+ * request is yet to be submitted with, are held until bsg returns it, see
+ * _rq_cancel_done().
+ */
+static void _rq_cancel(struct request *rq, int error)
+{
+	_rq_end_bios(rq);
+	if (rq->cancelled_next_rq)
+		_rq_end_bios(rq->cancelled_next_rq);
+
+	rq->errors = error;
+	rq->resid_len = rq->__data_len;
+	rq->sense_len = 0;
+
+	if (rq->rq_end_io)
+		rq->rq_end_io(rq, error);
+	else
+		blk_put_request(rq);
+}
+
+static void _rq_cancel_done(struct request *rq)
+{
+	struct request *next_rq = rq->cancelled_next_rq;
+
+	if (next_rq) {
+		_rq_put_bounce(next_rq, false);
+		_rq_put_iovec(next_rq);
+		blk_put_request(next_rq);
+	}
+	_rq_put_bounce(rq, false);
+	_rq_put_iovec(rq);
+	blk_put_request(rq);
+}
+
+void bsg_set_deadline(struct request *rq, unsigned msecs)
+{
+	rq->deadline = msecs ? _now_msec() + msecs : 0;
+}
+
+/*
+ * Returns 0, or -EALREADY if @rq is not in flight. Only the data of
+ * requests with a deadline is bounced, others are refused with -EINVAL
+ * since the device may still access the owner's buffers.
+ */
+int bsg_cancel_request(struct request *rq, int error)
+{
+	if (!rq->deadline)
+		return -EINVAL;
+
+	if (!_rq_try_cancel(rq))
+		return -EALREADY;
+
+	_rq_disarm(rq->q, rq);
+	_rq_cancel(rq, error);
+	return 0;
+}
+
+/* Complete with -ETIMEDOUT all requests past their deadline */
+int bsg_expire_deadlines(struct request_queue *q)
+{
+	struct bsg_timer_wheel *tw = &q->tw;
+	struct request *expired = NULL;
+	struct request *rq;
+	u64 now, tick, end;
+	int n = 0;
 
-	/* Perform an async run */
-	_queue_inc_requests(q);
-	ret = write(q->fd, &sg, sizeof(sg));
-	if (likely(ret == sizeof(sg)))
+	if (!tw->count)
 		return 0;
 
-	/* Failed! request not submitted */
-	_queue_dec_requests(q);
+	now = _now_msec();
+	end = now / BSG_TW_TICK_MS;
+
+	pthread_mutex_lock(&tw->lock);
+	tick = tw->last_tick;
+	if (end - tick >= BSG_TW_SLOTS)
+		tick = end - BSG_TW_SLOTS + 1;
+
+	for (; tick <= end; tick++) {
+		struct request **pp = &tw->slots[tick % BSG_TW_SLOTS];
+
+		while ((rq = *pp) != NULL) {
+			/* later rotation, or completing right now. A completing
+			 * @rq is not freed before it is off the wheel.
+			 */
+			if ((rq->deadline > now) || !_rq_try_cancel(rq)) {
+				pp = &rq->tw_next;
+				continue;
+			}
+
+			_tw_del(tw, rq);
+			rq->tw_next = expired;
+			expired = rq;
+		}
+	}
+	tw->last_tick = end;
+	pthread_mutex_unlock(&tw->lock);
+
+	while ((rq = expired) != NULL) {
+		expired = rq->tw_next;
+		rq->tw_next = NULL;
+		bsg_dbg("request %p expired\n", rq);
+		_rq_cancel(rq, -ETIMEDOUT);
+		++n;
+	}
+
+	return n;
+}
+
+static void _bsg_complete(struct request_queue *q, struct bsg_queue *bq,
+			  struct sg_io_v4 *sg)
+{
+	struct request *rq = (void *)(unsigned long) sg->usr_ptr;
 
-error:
-	if (!ret && rq->errors) {
-		errno = EIO; ret = -EIO;
+	_queue_dec_requests(q, bq);
+	if (unlikely(!_rq_set_state(rq, BSG_RQ_DONE))) {
+		_rq_cancel_done(rq);
+		return;
 	}
+	_rq_disarm(q, rq);
+	__end_io(rq, sg);
+
+	if (rq->rq_end_io)
+		rq->rq_end_io(rq, sg->device_status);
+	else
+		blk_put_request(rq);
+}
+
+static void _rq_fail(struct request *rq, int error)
+{
+	_blk_end_request(rq, error);
+	rq->errors = error;
+	rq->sense_len = 0;
+
+	if (rq->rq_end_io)
+		rq->rq_end_io(rq, error);
+	else
+		blk_put_request(rq);
+}
+
+/*
+ * A queued command was refused by bsg. Called with bq->lock held, so @rq
+ * is only moved to the @tail of a failed list, see _bsg_end_failed().
+ */
+static void _bsg_fail(struct request_queue *q, struct bsg_queue *bq,
+		      struct sg_io_v4 *sg, int error, struct request ***tail)
+{
+	struct request *rq = (void *)(unsigned long) sg->usr_ptr;
+
+	if (error == -EOPNOTSUPP)
+		bsg_error("Device (fd=%d) does not support BIDI", bq->fd);
+	else
+		bsg_dbg("write: %s\n", strerror(-error));
+
+	_queue_dec_requests(q, bq);
+	if (unlikely(!_rq_set_state(rq, BSG_RQ_DONE))) {
+		_rq_cancel_done(rq);
+		return;
+	}
+	_rq_disarm(q, rq);
+	/* off the timer wheel, tw_next is free to link the failed list */
+	rq->errors = error;
+	rq->tw_next = NULL;
+	**tail = rq;
+	*tail = &rq->tw_next;
+}
+
+/* Done callbacks may submit again, call them after bq->lock is dropped */
+static void _bsg_end_failed(struct request *failed)
+{
+	struct request *rq;
+
+	while ((rq = failed) != NULL) {
+		failed = rq->tw_next;
+		rq->tw_next = NULL;
+		_rq_fail(rq, rq->errors);
+	}
+}
+
+static void _bsg_wait_writable(struct bsg_queue *bq)
+{
+	struct pollfd pfd = {.fd = bq->fd, .events = POLLOUT};
+
+	while (poll(&pfd, 1, -1) < 0 && errno == EINTR)
+		;
+}
+
+/*
+ * Submit all queued commands, as many as bsg will take per write().
+ * Called with bq->lock held. Refused commands are returned on @failed, for
+ * _bsg_end_failed() once the lock is dropped.
+ */
+static void _bsg_flush(struct request_queue *q, struct bsg_queue *bq,
+		       struct request **failed)
+{
+	struct sg_io_v4 *sq = bq->sq;
+	struct request **tail = failed;
+	unsigned done = 0;
+	int ret;
+
+	while (done < bq->sq_num) {
+		ret = write(bq->fd, &sq[done],
+			    (bq->sq_num - done) * sizeof(*sq));
+		if (likely(ret >= (int)sizeof(*sq))) {
+			done += ret / sizeof(*sq);
+			continue;
+		}
+
+		if (ret < 0 && (errno == EINTR || errno == EAGAIN)) {
+			_bsg_wait_writable(bq);
+			continue;
+		}
+
+		if (ret >= 0) {
+			bsg_error("Short write, %d not %zu", ret, sizeof(*sq));
+			_bsg_fail(q, bq, &sq[done], -EIO, &tail);
+		} else
+			_bsg_fail(q, bq, &sq[done], -errno, &tail);
+		++done;
+	}
+
+	bsg_dbg("_bsg_flush(%d) => %u\n", bq->fd, done);
+	bq->sq_num = 0;
+}
+
+static void _bsg_flush_all(struct request_queue *q)
+{
+	unsigned i;
+
+	for (i = 0; i < q->nr_queues; i++) {
+		struct bsg_queue *bq = &q->queues[i];
+
+		struct request *failed = NULL;
+
+		if (!bq->sq_num)
+			continue;
+
+		pthread_mutex_lock(&bq->lock);
+		_bsg_flush(q, bq, &failed);
+		pthread_mutex_unlock(&bq->lock);
+		_bsg_end_failed(failed);
+	}
+}
+
+static int _bsg_submit_request(struct request_queue *q, struct request *rq,
+				bool sync)
+{
+	struct bsg_queue *bq = _this_thread_queue(q);
+	struct request *failed = NULL;
+	int ret;
+	struct sg_io_v4 sg, *sg_p;
+
+	if (sync) {
+		/* keep submission order */
+		if (bq->sq_num) {
+			pthread_mutex_lock(&bq->lock);
+			_bsg_flush(q, bq, &failed);
+			pthread_mutex_unlock(&bq->lock);
+			_bsg_end_failed(failed);
+		}
+
+		_bsg_prep_sg(q, rq, &sg);
+		ret = ioctl(bq->fd, SG_IO, &sg);
+		__end_io(rq, &sg);
+		bsg_dbg("ioctl(%d,SG_IO) => %d\n", bq->fd, ret);
+		if (likely(!ret && !rq->errors))
+			return 0;
+
+		if (!ret && rq->errors)
+			return -EIO;
 
-	if (ret < 0) {
 		ret = -errno;
 		if (ret == -EOPNOTSUPP)
-			bsg_error(
-			    "bsg: Error: Device (fd=%d) does not support BIDI",
-			    q->fd);
+			bsg_error("Device (fd=%d) does not support BIDI",
+				  bq->fd);
 		else
-			bsg_dbg("%s: %s\n", sync ? "ioctl" : "write",
-				strerror(errno));
-	} else {
-		bsg_error("Short write, %d not %zu", ret, sizeof(sg));
-		ret = -EIO;
+			bsg_dbg("ioctl: %s\n", strerror(errno));
+		return ret;
 	}
-	return ret;
+
+	/* Perform an async run, errors are reported through rq_end_io */
+	ret = _queue_reserve(q);
+	if (unlikely(ret)) {
+		_rq_fail(rq, ret);
+		return ret;
+	}
+
+	pthread_mutex_lock(&bq->lock);
+	_queue_inc_requests(bq);
+	sg_p = (struct sg_io_v4 *)bq->sq + bq->sq_num;
+	_bsg_prep_sg(q, rq, sg_p);
+	/* owner's cdb might be freed if cancelled before we write() */
+	if (likely(rq->cmd_len <= sizeof(rq->__cmd))) {
+		memcpy(rq->__cmd, rq->cmd, rq->cmd_len);
+		sg_p->request = (uint64_t) (unsigned long) rq->__cmd;
+	}
+	_rq_arm(q, rq);
+	++bq->sq_num;
+
+	if (!q->plugged || bq->sq_num >= BSG_MAX_BATCH)
+		_bsg_flush(q, bq, &failed);
+	pthread_mutex_unlock(&bq->lock);
+	_bsg_end_failed(failed);
+	return 0;
 }
 
-static int _bsg_wait_response(struct request_queue *q)
+void blk_plug_device(struct request_queue *q)
 {
-	struct sg_io_v4 sg;
-	struct request *rq;
+	q->plugged = 1;
+}
+
+void blk_unplug(struct request_queue *q)
+{
+	q->plugged = 0;
+	_bsg_flush_all(q);
+}
+
+/* Reap up to @max already completed commands. Does not block */
+static int _bsg_reap(struct request_queue *q, struct bsg_queue *bq, int max)
+{
+	struct sg_io_v4 cq[BSG_MAX_BATCH];
+	int n, i;
 	int ret;
 
-	ret = read(q->fd, &sg, sizeof(sg));
+	if (max > BSG_MAX_BATCH)
+		max = BSG_MAX_BATCH;
+
+	ret = read(bq->fd, cq, max * sizeof(cq[0]));
 	if (ret < 0) {
+		if (errno == EAGAIN || errno == EINTR)
+			return 0;
 		bsg_error_errno("%s: read", __func__);
 		return -errno;
 	}
-	if (ret != sizeof(sg)) {
+	if (ret % sizeof(cq[0])) {
 		bsg_error("%s: short read, %d not %zu", __func__, ret,
-		          sizeof(sg));
+		          sizeof(cq[0]));
 		return -EPIPE;
 	}
 
-	rq = (void *)(unsigned long) sg.usr_ptr;
-	_queue_dec_requests(rq->q);
-	__end_io(rq, &sg);
+	n = ret / sizeof(cq[0]);
+	for (i = 0; i < n; i++)
+		_bsg_complete(q, bq, &cq[i]);
 
-	if (rq->rq_end_io)
-		rq->rq_end_io(rq, sg.device_status);
-	else
-		blk_put_request(rq);
+	return n;
+}
 
-	return 0;
+/* One pass over all queues that have requests in flight */
+static int _bsg_reap_all(struct request_queue *q, int max)
+{
+	unsigned i;
+	int done = 0;
+	int ret;
+
+	for (i = 0; (i < q->nr_queues) && (done < max); i++) {
+		struct bsg_queue *bq = &q->queues[i];
+
+		if (!bq->num_requests)
+			continue;
+
+		ret = _bsg_reap(q, bq, max - done);
+		if (unlikely(ret < 0))
+			return done ? done : ret;
+		done += ret;
+	}
+
+	return done;
+}
+
+static int _msec_since(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1000 +
+	       (now.tv_nsec - start->tv_nsec) / 1000000;
 }
 
 /*
-int bsg_wait_response(struct request_queue *q)
+ * Reap between @min and @max completed requests. Waits up to @timeout
+ * milliseconds (-1 forever) for the first @min, then only collects what
+ * is already available. @max <= 0 means no upper limit.
+ * Returns the number of requests completed, or negative error.
+ */
+int bsg_poll_completions(struct request_queue *q, int min, int max,
+			 int timeout)
 {
+	struct pollfd pfd[BSG_MAX_QUEUES];
+	struct timespec start;
+	unsigned i;
+	int done = 0;
 	int ret;
 
-	while(_queue_num_requests(q)) {
-		ret = _bsg_wait_response(q->fd);
+	if (max <= 0)
+		max = INT_MAX;
+
+	for (i = 0; i < q->nr_queues; i++) {
+		pfd[i].fd = q->queues[i].fd;
+		pfd[i].events = POLLIN;
+	}
+
+	_bsg_flush_all(q);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	while ((done < max) && _queue_num_requests(q)) {
+		int wait = 0;
+
+		ret = _bsg_reap_all(q, max - done);
+		if (unlikely(ret < 0))
+			return done ? done : ret;
+		ret += bsg_expire_deadlines(q);
+		done += ret;
 		if (ret)
-			return ret;
+			continue;
+
+		/* nothing ready */
+		if (done >= min || !timeout)
+			break;
+
+		wait = timeout;
+		if (timeout > 0) {
+			wait = timeout - _msec_since(&start);
+			if (wait <= 0)
+				break;
+		}
+		/* wake up to expire deadlines */
+		if (q->tw.count && (wait < 0 || wait > BSG_TW_TICK_MS))
+			wait = BSG_TW_TICK_MS;
+
+		ret = poll(pfd, q->nr_queues, wait);
+		if (unlikely(ret < 0) && errno != EINTR) {
+			bsg_error_errno("%s: poll", __func__);
+			return done ? done : -errno;
+		}
 	}
 
-	return 0;
+	bsg_dbg("bsg_poll_completions(%d, %d) => %d\n", min, max, done);
+	return done;
+}
+
+/*
+ * Complete all that is ready on @q. Never blocks and does not submit
+ * queued requests. For use by an external event loop.
+ */
+int bsg_reap_ready(struct request_queue *q)
+{
+	int done = 0;
+	int ret;
+
+	do {
+		ret = _bsg_reap_all(q, INT_MAX);
+		if (unlikely(ret < 0))
+			return done ? done : ret;
+		done += ret;
+	} while (ret);
+
+	return done + bsg_expire_deadlines(q);
+}
+
+/*
+ * Block until all in-flight requests on @q have completed.
+ */
+int bsg_wait_all(struct request_queue *q)
+{
+	int ret;
+
+	ret = bsg_poll_completions(q, INT_MAX, 0, -1);
+	return ret < 0 ? ret : 0;
 }
-*/
 
 int blk_execute_rq(struct request_queue *q __unused,
 		   void *bd_disk_unused __unused, struct request *rq,
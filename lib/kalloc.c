@@ -1,30 +1,476 @@
 #include "kalloc.h"
+#include <pthread.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 #define __unused			__attribute__((unused))
 
+/*
+ * kmem_cache
+ */
+#define KMEM_MAGAZINE_SIZE	32
+#define KMEM_SLAB_SIZE		(64 * 1024)
+#define KMEM_MIN_ALIGN		16
+
+struct kmem_cache;
+
+struct kmem_magazine {
+	struct kmem_cache *cachep;
+	struct kmem_magazine *next, **pprev; /* under cachep->lock */
+	unsigned nr;
+	void *objs[KMEM_MAGAZINE_SIZE];
+};
+
+struct kmem_cache {
+	const char *name;
+	size_t size;
+	void (*ctor)(void *);
+	pthread_key_t mag_key;
+
+	pthread_mutex_t lock; /* protects below */
+	struct kmem_magazine *mags; /* of all threads */
+	void *free_list; /* linked through first word of each object */
+	void *slabs; /* linked through first word of each slab */
+	size_t slab_offset; /* first object in a slab */
+	unsigned objs_per_slab;
+};
+
+/* Carve a new slab into the free_list. Called with cachep->lock held */
+static int _kmem_cache_grow(struct kmem_cache *cachep)
+{
+	char *slab;
+	unsigned i;
+
+	if (posix_memalign((void **)&slab, KMEM_MIN_ALIGN, KMEM_SLAB_SIZE))
+		return -1;
+
+	*(void **)slab = cachep->slabs;
+	cachep->slabs = slab;
+
+	for (i = 0; i < cachep->objs_per_slab; i++) {
+		void **obj = (void **)(slab + cachep->slab_offset +
+				       i * cachep->size);
+
+		*obj = cachep->free_list;
+		cachep->free_list = obj;
+	}
+	return 0;
+}
+
+/* Move objects between a magazine and the cache free_list */
+static void _mag_refill(struct kmem_magazine *mag)
+{
+	struct kmem_cache *cachep = mag->cachep;
+
+	pthread_mutex_lock(&cachep->lock);
+	while (mag->nr < KMEM_MAGAZINE_SIZE / 2) {
+		void **obj = cachep->free_list;
+
+		if (!obj) {
+			if (_kmem_cache_grow(cachep))
+				break;
+			continue;
+		}
+		cachep->free_list = *obj;
+		mag->objs[mag->nr++] = obj;
+	}
+	pthread_mutex_unlock(&cachep->lock);
+}
+
+static void _mag_drain(struct kmem_magazine *mag, unsigned keep)
+{
+	struct kmem_cache *cachep = mag->cachep;
+
+	pthread_mutex_lock(&cachep->lock);
+	while (mag->nr > keep) {
+		void **obj = mag->objs[--mag->nr];
+
+		*obj = cachep->free_list;
+		cachep->free_list = obj;
+	}
+	pthread_mutex_unlock(&cachep->lock);
+}
+
+/* thread exit */
+static void _mag_destroy(void *p)
+{
+	struct kmem_magazine *mag = p;
+	struct kmem_cache *cachep = mag->cachep;
+
+	_mag_drain(mag, 0);
+
+	pthread_mutex_lock(&cachep->lock);
+	if (mag->next)
+		mag->next->pprev = mag->pprev;
+	*mag->pprev = mag->next;
+	pthread_mutex_unlock(&cachep->lock);
+	free(mag);
+}
+
+static struct kmem_magazine *_this_magazine(struct kmem_cache *cachep)
+{
+	struct kmem_magazine *mag = pthread_getspecific(cachep->mag_key);
+
+	if (likely(mag))
+		return mag;
+
+	mag = calloc(1, sizeof(*mag));
+	if (unlikely(!mag))
+		return NULL;
+
+	mag->cachep = cachep;
+	if (pthread_setspecific(cachep->mag_key, mag)) {
+		free(mag);
+		return NULL;
+	}
+
+	pthread_mutex_lock(&cachep->lock);
+	mag->next = cachep->mags;
+	if (mag->next)
+		mag->next->pprev = &mag->next;
+	mag->pprev = &cachep->mags;
+	cachep->mags = mag;
+	pthread_mutex_unlock(&cachep->lock);
+	return mag;
+}
+
+struct kmem_cache *kmem_cache_create(const char *name, size_t size,
+				     size_t align, unsigned long flags,
+				     void (*ctor)(void *))
+{
+	struct kmem_cache *cachep;
+
+	if (flags & SLAB_HWCACHE_ALIGN && align < 64)
+		align = 64;
+	if (align < KMEM_MIN_ALIGN)
+		align = KMEM_MIN_ALIGN;
+	if (size < sizeof(void *))
+		size = sizeof(void *);
+	size = ALIGN(size, align);
+
+	if (size > KMEM_SLAB_SIZE / 4)
+		return NULL;
+
+	cachep = calloc(1, sizeof(*cachep));
+	if (unlikely(!cachep))
+		return NULL;
+
+	if (pthread_key_create(&cachep->mag_key, _mag_destroy)) {
+		free(cachep);
+		return NULL;
+	}
+	pthread_mutex_init(&cachep->lock, NULL);
+	cachep->name = name;
+	cachep->size = size;
+	cachep->ctor = ctor;
+	cachep->slab_offset = ALIGN(sizeof(void *), align);
+	cachep->objs_per_slab = (KMEM_SLAB_SIZE - cachep->slab_offset) / size;
+	return cachep;
+}
+
+/* All objects must have been freed, and no thread may still use the cache.
+ * The magazines of all threads are released, their objects are in the
+ * slabs freed below.
+ */
+void kmem_cache_destroy(struct kmem_cache *cachep)
+{
+	struct kmem_magazine *mag;
+	void *slab;
+
+	if (!cachep)
+		return;
+
+	/* No thread exit destructor runs on a deleted key */
+	pthread_key_delete(cachep->mag_key);
+	pthread_mutex_lock(&cachep->lock);
+	while ((mag = cachep->mags)) {
+		cachep->mags = mag->next;
+		free(mag);
+	}
+	pthread_mutex_unlock(&cachep->lock);
+
+	while ((slab = cachep->slabs)) {
+		cachep->slabs = *(void **)slab;
+		free(slab);
+	}
+	pthread_mutex_destroy(&cachep->lock);
+	free(cachep);
+}
+
+void *kmem_cache_alloc(struct kmem_cache *cachep, gfp_t flags __unused)
+{
+	struct kmem_magazine *mag = _this_magazine(cachep);
+	void *objp;
+
+	if (unlikely(!mag))
+		return NULL;
+
+	if (unlikely(!mag->nr)) {
+		_mag_refill(mag);
+		if (unlikely(!mag->nr))
+			return NULL;
+	}
+
+	objp = mag->objs[--mag->nr];
+	if (cachep->ctor)
+		cachep->ctor(objp);
+	return objp;
+}
+
+void *kmem_cache_zalloc(struct kmem_cache *cachep, gfp_t flags)
+{
+	void *objp = kmem_cache_alloc(cachep, flags);
+
+	if (objp)
+		memset(objp, 0, cachep->size);
+	return objp;
+}
+
+void kmem_cache_free(struct kmem_cache *cachep, void *objp)
+{
+	struct kmem_magazine *mag;
+
+	if (!objp)
+		return;
+
+	mag = _this_magazine(cachep);
+	if (unlikely(!mag)) {
+		void **obj = objp;
+
+		pthread_mutex_lock(&cachep->lock);
+		*obj = cachep->free_list;
+		cachep->free_list = obj;
+		pthread_mutex_unlock(&cachep->lock);
+		return;
+	}
+
+	if (unlikely(mag->nr == KMEM_MAGAZINE_SIZE))
+		_mag_drain(mag, KMEM_MAGAZINE_SIZE / 2);
+	mag->objs[mag->nr++] = objp;
+}
+
+/*
+ * kalloc. Small sizes come from power of 2 kmem_caches, bigger from malloc.
+ * A header in front of each buffer says which.
+ */
+#define KALLOC_MIN_SHIFT	5 /* 32 bytes */
+#define KALLOC_CLASSES		7 /* up to 2K */
+
+struct kalloc_hdr {
+	struct kmem_cache *cachep; /* NULL for malloc */
+	size_t size; /* usable size */
+} __attribute__((aligned(16)));
+
+static struct kmem_cache *g_kalloc_caches[KALLOC_CLASSES];
+static pthread_once_t g_kalloc_once = PTHREAD_ONCE_INIT;
+
+static void _kalloc_init(void)
+{
+	static const char *names[KALLOC_CLASSES] = {
+		"kalloc-32", "kalloc-64", "kalloc-128", "kalloc-256",
+		"kalloc-512", "kalloc-1024", "kalloc-2048",
+	};
+	int c;
+
+	for (c = 0; c < KALLOC_CLASSES; c++)
+		g_kalloc_caches[c] = kmem_cache_create(names[c],
+			sizeof(struct kalloc_hdr) + (1 << (KALLOC_MIN_SHIFT + c)),
+			0, 0, NULL);
+}
+
 void *kalloc(size_t size, gfp_t unused __unused)
 {
-	return malloc(size);
+	struct kalloc_hdr *hdr = NULL;
+	size_t usable = 1 << KALLOC_MIN_SHIFT;
+	int c;
+
+	pthread_once(&g_kalloc_once, _kalloc_init);
+
+	for (c = 0; c < KALLOC_CLASSES; c++, usable <<= 1) {
+		if (size <= usable) {
+			if (likely(g_kalloc_caches[c]))
+				hdr = kmem_cache_alloc(g_kalloc_caches[c], 0);
+			break;
+		}
+	}
+
+	if (hdr) {
+		hdr->cachep = g_kalloc_caches[c];
+		hdr->size = usable;
+	} else {
+		hdr = malloc(sizeof(*hdr) + size);
+		if (unlikely(!hdr))
+			return NULL;
+		hdr->cachep = NULL;
+		hdr->size = size;
+	}
+
+	return hdr + 1;
 }
 
-void *kzalloc(size_t size, gfp_t unused __unused)
+void *kzalloc(size_t size, gfp_t unused)
 {
-	return calloc(size, 1);
+	void *p = kalloc(size, unused);
+
+	if (p)
+		memset(p, 0, size);
+	return p;
 }
 
-void *krealloc(const void *p, size_t new_size, gfp_t flags __unused)
+void *krealloc(const void *p, size_t new_size, gfp_t flags)
 {
-	return realloc((void *)p, new_size);
+	const struct kalloc_hdr *hdr;
+	void *n;
+
+	if (!p)
+		return kalloc(new_size, flags);
+
+	hdr = (const struct kalloc_hdr *)p - 1;
+	if (new_size <= hdr->size)
+		return (void *)p;
+
+	n = kalloc(new_size, flags);
+	if (unlikely(!n))
+		return NULL;
+
+	memcpy(n, p, hdr->size);
+	kfree(p);
+	return n;
 }
 
 void kfree(const void *objp)
 {
+	struct kalloc_hdr *hdr;
+
 	if (!objp) /* is free NULL safe? */
 		return;
 
-	free((void *)objp);
+	hdr = (struct kalloc_hdr *)objp - 1;
+	if (hdr->cachep)
+		kmem_cache_free(hdr->cachep, hdr);
+	else
+		free(hdr);
+}
+
+/*
+ * mempool
+ */
+struct mempool_s {
+	pthread_mutex_t lock;
+	pthread_cond_t wait;
+	int min_nr;
+	int curr_nr;
+	void **elements;
+
+	void *pool_data;
+	mempool_alloc_t *alloc;
+	mempool_free_t *free;
+};
+
+mempool_t *mempool_create(int min_nr, mempool_alloc_t *alloc_fn,
+			  mempool_free_t *free_fn, void *pool_data)
+{
+	mempool_t *pool = calloc(1, sizeof(*pool));
+
+	if (!pool)
+		return NULL;
+
+	pool->elements = calloc(min_nr ? min_nr : 1, sizeof(void *));
+	if (!pool->elements) {
+		free(pool);
+		return NULL;
+	}
+
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->wait, NULL);
+	pool->min_nr = min_nr;
+	pool->pool_data = pool_data;
+	pool->alloc = alloc_fn;
+	pool->free = free_fn;
+
+	/* fill the reserve */
+	while (pool->curr_nr < pool->min_nr) {
+		void *element = pool->alloc(GFP_KERNEL, pool->pool_data);
+
+		if (!element) {
+			mempool_destroy(pool);
+			return NULL;
+		}
+		pool->elements[pool->curr_nr++] = element;
+	}
+	return pool;
+}
+
+void mempool_destroy(mempool_t *pool)
+{
+	if (!pool)
+		return;
+
+	while (pool->curr_nr)
+		pool->free(pool->elements[--pool->curr_nr], pool->pool_data);
+
+	pthread_cond_destroy(&pool->wait);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool->elements);
+	free(pool);
+}
+
+void *mempool_alloc(mempool_t *pool, gfp_t gfp_mask)
+{
+	void *element = pool->alloc(gfp_mask, pool->pool_data);
+
+	if (likely(element))
+		return element;
+
+	pthread_mutex_lock(&pool->lock);
+	while (!pool->curr_nr) {
+		if (gfp_mask & GFP_NOWAIT) {
+			pthread_mutex_unlock(&pool->lock);
+			return NULL;
+		}
+		pthread_cond_wait(&pool->wait, &pool->lock);
+	}
+	element = pool->elements[--pool->curr_nr];
+	pthread_mutex_unlock(&pool->lock);
+
+	return element;
+}
+
+void mempool_free(void *element, mempool_t *pool)
+{
+	if (unlikely(!element))
+		return;
+
+	/* racy peek, like Kernel. Refill the reserve when it was used */
+	if (unlikely(pool->curr_nr < pool->min_nr)) {
+		pthread_mutex_lock(&pool->lock);
+		if (pool->curr_nr < pool->min_nr) {
+			pool->elements[pool->curr_nr++] = element;
+			pthread_cond_signal(&pool->wait);
+			pthread_mutex_unlock(&pool->lock);
+			return;
+		}
+		pthread_mutex_unlock(&pool->lock);
+	}
+
+	pool->free(element, pool->pool_data);
+}
+
+static void *_mempool_alloc_slab(gfp_t gfp_mask, void *pool_data)
+{
+	return kmem_cache_alloc(pool_data, gfp_mask);
+}
+
+static void _mempool_free_slab(void *element, void *pool_data)
+{
+	kmem_cache_free(pool_data, element);
+}
+
+mempool_t *mempool_create_slab_pool(int min_nr, struct kmem_cache *kc)
+{
+	return mempool_create(min_nr, _mempool_alloc_slab, _mempool_free_slab,
+			      kc);
 }
 
 unsigned long __get_free_page(gfp_t unused __unused)
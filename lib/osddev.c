@@ -38,8 +38,13 @@
  */
 
 #include <dirent.h>
+#include <limits.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
 
 #include <open-osd/libosd.h>
 #include <linux/blkdev.h>
@@ -54,33 +59,535 @@ struct libosd_dev {
 	struct osd_dev_info odi;
 	struct request_queue bsg;
 	struct scsi_device scsi_device;
+	bool reaped; /* attached to g_reaper */
+	int reaping; /* held by the reaper thread, under g_reaper.lock */
+
+	/* in g_registry, protected by g_registry.lock */
+	bool shared; /* only shared opens are in g_registry */
+	int ref;
+	char bsg_path[_POSIX_PATH_MAX];
+	struct libosd_dev *next;
 };
 
-int osd_open(const char *osd_path, struct osd_dev **pod)
+/*
+ * Process wide registry of shared open devices. A shared open of the same
+ * OSD again, by its /dev/osdX path or by its systemid/osdname, returns the
+ * already open handle with an extra reference. The osd path to bsg path
+ * resolution, a sysfs walk, is cached and revalidated by the device
+ * number of the osd path.
+ */
+struct osd_path_cache {
+	struct osd_path_cache *next;
+	dev_t rdev;
+	char osd_path[_POSIX_PATH_MAX];
+	char bsg_path[_POSIX_PATH_MAX];
+};
+
+struct osd_registry {
+	pthread_mutex_t lock;
+	struct libosd_dev *devs;
+	struct osd_path_cache *paths;
+};
+
+static struct osd_registry g_registry = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+/*
+ * Optional completion reaper. A single thread waits with epoll on the bsg
+ * fds of all attached devices and completes requests as soon as they are
+ * done. The done callbacks are called from the reaper thread, with no
+ * reaper lock held, so they may submit, close or detach devices.
+ * The thread exits on its own once the last device is detached, nobody
+ * ever joins it.
+ */
+#define OSD_REAPER_EVENTS 64
+
+struct osd_reaper {
+	pthread_mutex_t cfg_lock; /* serializes attach/detach */
+	pthread_mutex_t lock; /* protects devs and lod->reaping */
+	pthread_cond_t idle; /* a device is no longer reaping */
+	pthread_t thread;
+	bool running;
+	int epfd;
+	int evfd; /* wakes the thread to check if it should exit */
+	unsigned num_devs;
+	unsigned max_devs;
+	struct libosd_dev **devs;
+};
+
+static struct osd_reaper g_reaper = {
+	.cfg_lock = PTHREAD_MUTEX_INITIALIZER,
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.idle = PTHREAD_COND_INITIALIZER,
+	.epfd = -1,
+	.evfd = -1,
+};
+
+static int _reaper_find(struct libosd_dev *lod)
+{
+	unsigned i;
+
+	for (i = 0; i < g_reaper.num_devs; i++)
+		if (g_reaper.devs[i] == lod)
+			return i;
+	return -1;
+}
+
+static inline bool _reaper_is_self(void)
+{
+	return g_reaper.running && pthread_equal(pthread_self(),
+						 g_reaper.thread);
+}
+
+/*
+ * Called with g_reaper.lock held. Take a reference on @lod so its
+ * completions can be dispatched after g_reaper.lock is dropped. Returns
+ * false if @lod is already on its way out in osd_close().
+ */
+static bool _reaper_get(struct libosd_dev *lod)
+{
+	bool ret;
+
+	pthread_mutex_lock(&g_registry.lock);
+	ret = lod->ref > 0;
+	if (ret)
+		++lod->ref;
+	pthread_mutex_unlock(&g_registry.lock);
+
+	if (ret)
+		++lod->reaping;
+	return ret;
+}
+
+static void _reaper_put(struct libosd_dev *lod)
+{
+	pthread_mutex_lock(&g_reaper.lock);
+	if (!--lod->reaping)
+		pthread_cond_broadcast(&g_reaper.idle);
+	pthread_mutex_unlock(&g_reaper.lock);
+
+	osd_close(&lod->od);
+}
+
+/* A done callback may have detached @lod, since it was picked up */
+static bool _reaper_still_attached(struct libosd_dev *lod)
+{
+	bool ret;
+
+	pthread_mutex_lock(&g_reaper.lock);
+	ret = lod->reaped;
+	pthread_mutex_unlock(&g_reaper.lock);
+	return ret;
+}
+
+/* Wake up every tick while an attached device has request deadlines */
+static int _reaper_expire_deadlines(void)
+{
+	struct libosd_dev **lods;
+	unsigned i, n = 0;
+	int timeout = -1;
+
+	pthread_mutex_lock(&g_reaper.lock);
+	if (!g_reaper.num_devs) {
+		pthread_mutex_unlock(&g_reaper.lock);
+		return -1;
+	}
+	lods = kalloc(g_reaper.num_devs * sizeof(*lods), 0);
+	if (likely(lods))
+		for (i = 0; i < g_reaper.num_devs; i++)
+			if (_reaper_get(g_reaper.devs[i]))
+				lods[n++] = g_reaper.devs[i];
+	pthread_mutex_unlock(&g_reaper.lock);
+
+	if (unlikely(!lods))
+		return BSG_TW_TICK_MS; /* try again next tick */
+
+	for (i = 0; i < n; i++) {
+		struct request_queue *q = &lods[i]->bsg;
+
+		if (_reaper_still_attached(lods[i])) {
+			bsg_expire_deadlines(q);
+			if (q->tw.count)
+				timeout = BSG_TW_TICK_MS;
+		}
+		_reaper_put(lods[i]);
+	}
+	kfree(lods);
+
+	return timeout;
+}
+
+/* Kick the thread to check if it should exit. Called with cfg_lock held */
+static void _reaper_kick(void)
+{
+	uint64_t one = 1;
+
+	if (write(g_reaper.evfd, &one, sizeof(one)) != sizeof(one))
+		OSD_ERR("reaper: eventfd write => %d\n", errno);
+}
+
+/* Returns true if the last device was detached and the thread should exit.
+ * Cleans up for the thread, since nobody joins it.
+ */
+static bool _reaper_exit(void)
+{
+	uint64_t cnt;
+	bool ret;
+
+	pthread_mutex_lock(&g_reaper.cfg_lock);
+	if (read(g_reaper.evfd, &cnt, sizeof(cnt)) != sizeof(cnt))
+		OSD_ERR("reaper: eventfd read => %d\n", errno);
+
+	ret = !g_reaper.num_devs;
+	if (ret) {
+		close(g_reaper.evfd);
+		g_reaper.evfd = -1;
+		close(g_reaper.epfd);
+		g_reaper.epfd = -1;
+		kfree(g_reaper.devs);
+		g_reaper.devs = NULL;
+		g_reaper.max_devs = 0;
+		g_reaper.running = false;
+		pthread_detach(pthread_self());
+	}
+	pthread_mutex_unlock(&g_reaper.cfg_lock);
+
+	return ret;
+}
+
+static void *_reaper_thread(void *arg __unused)
+{
+	struct epoll_event events[OSD_REAPER_EVENTS];
+	struct libosd_dev *lods[OSD_REAPER_EVENTS];
+	bool kicked;
+	int timeout = -1;
+	int n, i, nr;
+
+	for (;;) {
+		n = epoll_wait(g_reaper.epfd, events, OSD_REAPER_EVENTS,
+			       timeout);
+		if (unlikely(n < 0)) {
+			if (errno == EINTR)
+				continue;
+			OSD_ERR("reaper: epoll_wait => %d\n", errno);
+			break;
+		}
+
+		kicked = false;
+		nr = 0;
+		pthread_mutex_lock(&g_reaper.lock);
+		for (i = 0; i < n; i++) {
+			struct libosd_dev *lod = events[i].data.ptr;
+
+			if (!lod) {
+				kicked = true;
+				continue;
+			}
+			/* might have been detached after epoll_wait */
+			if (_reaper_find(lod) >= 0 && _reaper_get(lod))
+				lods[nr++] = lod;
+		}
+		pthread_mutex_unlock(&g_reaper.lock);
+
+		for (i = 0; i < nr; i++) {
+			if (_reaper_still_attached(lods[i]))
+				bsg_reap_ready(&lods[i]->bsg);
+			_reaper_put(lods[i]);
+		}
+
+		if (kicked && _reaper_exit())
+			break;
+
+		timeout = _reaper_expire_deadlines();
+	}
+
+	return NULL;
+}
+
+/* Called with cfg_lock held */
+static int _reaper_start(void)
+{
+	struct epoll_event ev = {.events = EPOLLIN, .data.ptr = NULL};
+	int ret;
+
+	g_reaper.epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (g_reaper.epfd < 0)
+		return errno;
+
+	g_reaper.evfd = eventfd(0, EFD_CLOEXEC);
+	if (g_reaper.evfd < 0) {
+		ret = errno;
+		goto close_ep;
+	}
+
+	if (epoll_ctl(g_reaper.epfd, EPOLL_CTL_ADD, g_reaper.evfd, &ev)) {
+		ret = errno;
+		goto close_ev;
+	}
+
+	ret = pthread_create(&g_reaper.thread, NULL, _reaper_thread, NULL);
+	if (unlikely(ret))
+		goto close_ev;
+
+	g_reaper.running = true;
+	return 0;
+
+close_ev:
+	close(g_reaper.evfd);
+	g_reaper.evfd = -1;
+close_ep:
+	close(g_reaper.epfd);
+	g_reaper.epfd = -1;
+	return ret;
+}
+
+int osd_reaper_attach(struct osd_dev *od)
+{
+	struct libosd_dev *lod = (struct libosd_dev *)od;
+	struct epoll_event ev = {.events = EPOLLIN, .data.ptr = lod};
+	unsigned i;
+	int ret = 0;
+
+	pthread_mutex_lock(&g_reaper.cfg_lock);
+	if (lod->reaped)
+		goto out;
+
+	/* An exiting thread is reused, it checks num_devs under cfg_lock */
+	if (!g_reaper.running) {
+		ret = _reaper_start();
+		if (unlikely(ret))
+			goto out;
+	}
+
+	if (g_reaper.num_devs == g_reaper.max_devs) {
+		unsigned max_devs = g_reaper.max_devs ? 2 * g_reaper.max_devs : 8;
+		void *devs;
+
+		pthread_mutex_lock(&g_reaper.lock);
+		devs = krealloc(g_reaper.devs,
+				max_devs * sizeof(*g_reaper.devs), 0);
+		if (likely(devs)) {
+			g_reaper.devs = devs;
+			g_reaper.max_devs = max_devs;
+		}
+		pthread_mutex_unlock(&g_reaper.lock);
+
+		if (unlikely(!devs)) {
+			ret = ENOMEM;
+			goto stop;
+		}
+	}
+
+	pthread_mutex_lock(&g_reaper.lock);
+	for (i = 0; i < lod->bsg.nr_queues; i++) {
+		if (epoll_ctl(g_reaper.epfd, EPOLL_CTL_ADD,
+			      lod->bsg.queues[i].fd, &ev)) {
+			ret = errno;
+			while (i--)
+				epoll_ctl(g_reaper.epfd, EPOLL_CTL_DEL,
+					  lod->bsg.queues[i].fd, NULL);
+			pthread_mutex_unlock(&g_reaper.lock);
+			goto stop;
+		}
+	}
+	g_reaper.devs[g_reaper.num_devs++] = lod;
+	lod->reaped = true;
+	lod->bsg.reaper = g_reaper.thread;
+	lod->bsg.reaper_attached = true;
+	pthread_mutex_unlock(&g_reaper.lock);
+	goto out;
+
+stop:
+	if (!g_reaper.num_devs)
+		_reaper_kick();
+out:
+	pthread_mutex_unlock(&g_reaper.cfg_lock);
+	return ret;
+}
+
+/*
+ * After detach returns no completions of @od are dispatched by the reaper.
+ * From a done callback, that is on the reaper thread, the detach does not
+ * wait: the callbacks of @od already being reaped may still run, and the
+ * thread exits only after the callback returns.
+ */
+void osd_reaper_detach(struct osd_dev *od)
+{
+	struct libosd_dev *lod = (struct libosd_dev *)od;
+	bool self;
+	unsigned q;
+	int i;
+
+	pthread_mutex_lock(&g_reaper.cfg_lock);
+	if (!lod->reaped) {
+		pthread_mutex_unlock(&g_reaper.cfg_lock);
+		return;
+	}
+
+	pthread_mutex_lock(&g_reaper.lock);
+	for (q = 0; q < lod->bsg.nr_queues; q++)
+		epoll_ctl(g_reaper.epfd, EPOLL_CTL_DEL, lod->bsg.queues[q].fd,
+			  NULL);
+	i = _reaper_find(lod);
+	g_reaper.devs[i] = g_reaper.devs[--g_reaper.num_devs];
+	lod->reaped = false;
+	lod->bsg.reaper_attached = false;
+	pthread_mutex_unlock(&g_reaper.lock);
+
+	if (!g_reaper.num_devs)
+		_reaper_kick();
+	self = _reaper_is_self();
+	pthread_mutex_unlock(&g_reaper.cfg_lock);
+
+	if (self)
+		return;
+
+	/* without cfg_lock, the callbacks we wait on might detach too */
+	pthread_mutex_lock(&g_reaper.lock);
+	while (lod->reaping)
+		pthread_cond_wait(&g_reaper.idle, &g_reaper.lock);
+	pthread_mutex_unlock(&g_reaper.lock);
+}
+
+static int _lookup_bsgpath(const char *osd_path, char *bsg_path)
+{
+	struct osd_path_cache *opc;
+	struct stat st;
+	int ret;
+
+	if (stat(osd_path, &st))
+		return ENODEV;
+
+	pthread_mutex_lock(&g_registry.lock);
+	for (opc = g_registry.paths; opc; opc = opc->next) {
+		if (strcmp(opc->osd_path, osd_path))
+			continue;
+		if (opc->rdev == st.st_rdev) {
+			strcpy(bsg_path, opc->bsg_path);
+			pthread_mutex_unlock(&g_registry.lock);
+			return 0;
+		}
+		break; /* device was replaced, resolve again */
+	}
+	pthread_mutex_unlock(&g_registry.lock);
+
+	if (strlen(osd_path) >= sizeof(opc->osd_path))
+		return osdpath_to_bsgpath(osd_path, bsg_path);
+
+	ret = osdpath_to_bsgpath(osd_path, bsg_path);
+	if (unlikely(ret))
+		return ret;
+
+	pthread_mutex_lock(&g_registry.lock);
+	for (opc = g_registry.paths; opc; opc = opc->next)
+		if (!strcmp(opc->osd_path, osd_path))
+			break;
+	if (!opc) {
+		opc = calloc(1, sizeof(*opc));
+		if (opc) {
+			strcpy(opc->osd_path, osd_path);
+			opc->next = g_registry.paths;
+			g_registry.paths = opc;
+		}
+	}
+	if (opc) {
+		opc->rdev = st.st_rdev;
+		strcpy(opc->bsg_path, bsg_path);
+	}
+	pthread_mutex_unlock(&g_registry.lock);
+	return 0;
+}
+
+static bool _the_same_or_null(const u8 *a1, unsigned a1_len,
+			      const u8 *a2, unsigned a2_len)
+{
+	if (!a2_len) /* User string is Empty means don't care */
+		return true;
+
+	if (a1_len != a2_len)
+		return false;
+
+	return 0 == memcmp(a1, a2, a1_len);
+}
+
+static bool _odi_match(const struct osd_dev_info *odi,
+		       const struct osd_dev_info *want, bool exact)
+{
+	if (exact && ((odi->systemid_len != want->systemid_len) ||
+		      (odi->osdname_len != want->osdname_len)))
+		return false;
+
+	return _the_same_or_null(odi->systemid, odi->systemid_len,
+				 want->systemid, want->systemid_len) &&
+	       _the_same_or_null(odi->osdname, odi->osdname_len,
+				 want->osdname, want->osdname_len);
+}
+
+/* Called with g_registry.lock held. Returns @lod with an extra reference */
+static struct libosd_dev *_registry_get(const char *bsg_path,
+					const struct osd_dev_info *odi,
+					bool exact, unsigned nr_queues)
+{
+	struct libosd_dev *lod;
+
+	for (lod = g_registry.devs; lod; lod = lod->next) {
+		if (lod->bsg.nr_queues < nr_queues)
+			continue;
+		if (bsg_path ? !strcmp(lod->bsg_path, bsg_path) :
+			       _odi_match(&lod->odi, odi, exact)) {
+			++lod->ref;
+			return lod;
+		}
+	}
+	return NULL;
+}
+
+static void _lod_free(struct libosd_dev *lod)
+{
+	osd_dev_fini(&lod->od);
+	bsg_close(&lod->bsg);
+	kfree(lod->odi.osdname);
+	free(lod);
+}
+
+static int _osd_open(const char *osd_path, unsigned nr_queues, bool share,
+		     struct osd_dev **pod)
 {
 	char bsg_path[_POSIX_PATH_MAX];
 	char caps[OSD_CAP_LEN];
-	struct libosd_dev *lod;
+	struct libosd_dev *lod, *shared;
 	int ret;
 
 	*pod = NULL;
 
-	lod = calloc(1, sizeof(*lod));
-	if (!lod)
-		return ENOMEM;
-
-	ret = osdpath_to_bsgpath(osd_path, bsg_path)) {
+	ret = _lookup_bsgpath(osd_path, bsg_path);
 	if (unlikely(ret)) {
 		OSD_ERR("Error in osdpath_to_bsgpath(%s) => %d",
 			osd_path, ret);
-		goto dealloc;
+		return ret;
+	}
+
+	if (share) {
+		pthread_mutex_lock(&g_registry.lock);
+		shared = _registry_get(bsg_path, NULL, false, nr_queues);
+		pthread_mutex_unlock(&g_registry.lock);
+		if (shared) {
+			*pod = &shared->od;
+			return 0;
+		}
 	}
 
-	ret = bsg_open(&lod->bsg, bsg_path);
+	lod = calloc(1, sizeof(*lod));
+	if (!lod)
+		return ENOMEM;
+
+	ret = bsg_open(&lod->bsg, bsg_path, nr_queues);
 	if (unlikely(ret)) {
 		OSD_ERR("Error bsg_open(%s) => %d", bsg_path, ret);
 		goto dealloc;
 	}
+	strcpy(lod->bsg_path, bsg_path);
 
 	lod->scsi_device.request_queue = &lod->bsg;
 	osd_dev_init(&lod->od, &lod->scsi_device);
@@ -91,24 +598,197 @@ int osd_open(const char *osd_path, struct osd_dev **pod)
 		goto bsg_close;
 	}
 
+	lod->ref = 1;
+	if (!share) {
+		*pod = &lod->od;
+		return 0;
+	}
+
+	/* Raced with another open, or same OSD through another path */
+	pthread_mutex_lock(&g_registry.lock);
+	shared = _registry_get(bsg_path, NULL, false, nr_queues);
+	if (!shared && lod->odi.systemid_len)
+		shared = _registry_get(NULL, &lod->odi, true, nr_queues);
+	if (!shared) {
+		lod->shared = true;
+		lod->next = g_registry.devs;
+		g_registry.devs = lod;
+	}
+	pthread_mutex_unlock(&g_registry.lock);
+
+	if (shared) {
+		_lod_free(lod);
+		lod = shared;
+	}
+
 	*pod = &lod->od;
 	return 0;
 
 bsg_close:
 	osd_dev_fini(&lod->od);
 	bsg_close(&lod->bsg);
+	kfree(lod->odi.osdname);
 dealloc:
 	free(lod);
 	return ret;
 }
 
+int osd_open_queues(const char *osd_path, unsigned nr_queues,
+		    struct osd_dev **pod)
+{
+	return _osd_open(osd_path, nr_queues, false, pod);
+}
+
+int osd_open_shared(const char *osd_path, unsigned nr_queues,
+		    struct osd_dev **pod)
+{
+	return _osd_open(osd_path, nr_queues, true, pod);
+}
+
+int osd_open(const char *osd_path, struct osd_dev **pod)
+{
+	return osd_open_queues(osd_path, 1, pod);
+}
+
 void osd_close(struct osd_dev *od)
 {
 	struct libosd_dev *lod = (struct libosd_dev *)od;
+	struct libosd_dev **pp;
 
-	osd_dev_fini(&lod->od);
-	bsg_close(&lod->bsg);
-	free(lod);
+	pthread_mutex_lock(&g_registry.lock);
+	if (--lod->ref > 0) {
+		pthread_mutex_unlock(&g_registry.lock);
+		return;
+	}
+	if (lod->shared)
+		for (pp = &g_registry.devs; *pp; pp = &(*pp)->next)
+			if (*pp == lod) {
+				*pp = lod->next;
+				break;
+			}
+	pthread_mutex_unlock(&g_registry.lock);
+
+	osd_reaper_detach(od);
+	_lod_free(lod);
+}
+
+struct osd_dev *osduld_path_lookup(const char *dev_name)
+{
+	struct osd_dev *od;
+	int ret;
+
+	ret = osd_open_shared(dev_name, 1, &od);
+	if (unlikely(ret))
+		return ERR_PTR(-ret);
+
+	return od;
+}
+
+/* osduld_info_lookup - Return an osd_dev matching @odi.
+ *
+ * Open devices are looked up first, then all /dev/osdX are tried.
+ * if @odi->systemid_len and/or @odi->osdname_len are zero, they act as a don't
+ * care.
+ */
+struct osd_dev *osduld_info_lookup(const struct osd_dev_info *odi)
+{
+	char osd_path[sizeof("/dev/") + NAME_MAX];
+	struct libosd_dev *lod;
+	struct dirent *entry;
+	DIR *dir;
+
+	pthread_mutex_lock(&g_registry.lock);
+	lod = _registry_get(NULL, odi, false, 1);
+	pthread_mutex_unlock(&g_registry.lock);
+	if (lod)
+		return &lod->od;
+
+	dir = opendir("/sys/class/scsi_osd/");
+	if (!dir)
+		return ERR_PTR(-ENODEV);
+
+	while ((entry = readdir(dir))) {
+		struct osd_dev *od;
+
+		if (entry->d_name[0] == '.')
+			continue;
+
+		snprintf(osd_path, sizeof(osd_path), "/dev/%s", entry->d_name);
+		if (osd_open_shared(osd_path, 1, &od))
+			continue;
+
+		if (_odi_match(osduld_device_info(od), odi, false)) {
+			closedir(dir);
+			return od;
+		}
+		osd_close(od);
+	}
+
+	closedir(dir);
+	return ERR_PTR(-ENODEV);
+}
+
+void osduld_put_device(struct osd_dev *od)
+{
+	if (od && !IS_ERR(od))
+		osd_close(od);
+}
+
+bool osduld_device_same(struct osd_dev *od, const struct osd_dev_info *odi)
+{
+	return _odi_match(osduld_device_info(od), odi, true);
+}
+
+int osd_poll_completions(struct osd_dev *od, int min, int max, int timeout)
+{
+	struct libosd_dev *lod = (struct libosd_dev *)od;
+
+	return bsg_poll_completions(&lod->bsg, min, max, timeout);
+}
+
+int osd_wait_all(struct osd_dev *od)
+{
+	struct libosd_dev *lod = (struct libosd_dev *)od;
+
+	return bsg_wait_all(&lod->bsg);
+}
+
+void osd_plug(struct osd_dev *od)
+{
+	struct libosd_dev *lod = (struct libosd_dev *)od;
+
+	blk_plug_device(&lod->bsg);
+}
+
+void osd_unplug(struct osd_dev *od)
+{
+	struct libosd_dev *lod = (struct libosd_dev *)od;
+
+	blk_unplug(&lod->bsg);
+}
+
+void osd_set_queue_depth(struct osd_dev *od, unsigned max_depth, bool nowait)
+{
+	struct libosd_dev *lod = (struct libosd_dev *)od;
+
+	bsg_set_queue_depth(&lod->bsg, max_depth, nowait);
+}
+
+int osd_set_request_deadline(struct osd_request *or, unsigned msecs)
+{
+	if (unlikely(!or->request))
+		return -EINVAL;
+
+	bsg_set_deadline(or->request, msecs);
+	return 0;
+}
+
+int osd_cancel_request(struct osd_request *or)
+{
+	if (unlikely(!or->request))
+		return -EALREADY;
+
+	return bsg_cancel_request(or->request, -ECANCELED);
 }
 
 const struct osd_dev_info *osduld_device_info(struct osd_dev *od)
@@ -143,7 +823,7 @@ int osdpath_to_bsgpath(const char *osd_path, char *bsg_path)
 				strcat(sys_path, "bsg/");
 				bsg_dir = opendir(sys_path);
 				if (!bsg_dir)
-					return ENODEV;
+					break;
 
 				while ((entry2 = readdir(bsg_dir))) {
 					/* ignore the . and .. entries */
@@ -151,16 +831,18 @@ int osdpath_to_bsgpath(const char *osd_path, char *bsg_path)
 						continue;
 					sprintf(bsg_path,
 						"/dev/bsg/%s", entry2->d_name);
-					return 0;
+					break;
 				}
+				closedir(bsg_dir);
 			} else {
 				/* name of device is of the form: bsg:X:X:X:X */
 				sprintf(bsg_path,
 					"/dev/bsg/%s", entry->d_name + 4);
-				return 0;
 			}
+			break;
 		}
 	}
 
-	return ENODEV;
+	closedir(device_dir);
+	return *bsg_path ? 0 : ENODEV;
 }
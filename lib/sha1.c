@@ -0,0 +1,281 @@
+/*
+ * sha1.c - User-mode emulation of Kernel's shash "sha1"
+ *
+ * Description: Portable SHA1 block transform, and one using the x86 SHA
+ *              extensions when the CPU has them. The choice is made at
+ *              crypto_alloc_shash(), like Kernel's sha1-generic / sha1-ni.
+ *
+ * Copyright: See COPYING file that comes with this distribution
+ */
+#include <crypto/hash.h>
+#include <crypto/sha.h>
+#include <asm/unaligned.h>
+#include "kalloc.h"
+
+#include <string.h>
+#include <errno.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#  define SHA1_HAVE_NI 1
+#  include <cpuid.h>
+#  include <immintrin.h>
+#endif
+
+typedef void (sha1_block_fn)(u32 *state, const u8 *data, unsigned blocks);
+
+struct crypto_shash {
+	sha1_block_fn *block_fn;
+};
+
+static inline u32 rol32(u32 word, unsigned shift)
+{
+	return (word << shift) | (word >> (32 - shift));
+}
+
+/* Message word @i, expanded in place in the 16 words window */
+#define SHA1_W(i) ((i) < 16 ? W[i] :					\
+	(W[(i) & 15] = rol32(W[((i) + 13) & 15] ^ W[((i) + 8) & 15] ^	\
+			     W[((i) + 2) & 15] ^ W[(i) & 15], 1)))
+
+#define SHA1_ROUND(i, f, k) do {					\
+	u32 t = rol32(a, 5) + (f) + e + (k) + SHA1_W(i);		\
+	e = d;								\
+	d = c;								\
+	c = rol32(b, 30);						\
+	b = a;								\
+	a = t;								\
+} while (0)
+
+static void sha1_generic_block(u32 *state, const u8 *data, unsigned blocks)
+{
+	u32 W[16];
+
+	while (blocks--) {
+		u32 a = state[0], b = state[1], c = state[2];
+		u32 d = state[3], e = state[4];
+		unsigned i;
+
+		for (i = 0; i < 16; i++)
+			W[i] = get_unaligned_be32(data + i * 4);
+
+		for (i = 0; i < 20; i++)
+			SHA1_ROUND(i, d ^ (b & (c ^ d)), 0x5a827999);
+		for (; i < 40; i++)
+			SHA1_ROUND(i, b ^ c ^ d, 0x6ed9eba1);
+		for (; i < 60; i++)
+			SHA1_ROUND(i, (b & c) | (d & (b | c)), 0x8f1bbcdc);
+		for (; i < 80; i++)
+			SHA1_ROUND(i, b ^ c ^ d, 0xca62c1d6);
+
+		state[0] += a;
+		state[1] += b;
+		state[2] += c;
+		state[3] += d;
+		state[4] += e;
+		data += SHA1_BLOCK_SIZE;
+	}
+}
+
+#ifdef SHA1_HAVE_NI
+/* Message schedule of rounds group @g from the previous four groups, held
+ * in M[] by (group % 4)
+ */
+#define SHA1_NI_SCHED(g)						\
+	M[(g) & 3] = _mm_sha1msg2_epu32(_mm_xor_si128(			\
+		_mm_sha1msg1_epu32(M[(g) & 3], M[((g) + 1) & 3]),	\
+		M[((g) + 2) & 3]), M[((g) + 3) & 3])
+
+/* Four rounds, group @g of 20 */
+#define SHA1_NI_ROUNDS(g) do {						\
+	if ((g) >= 4)							\
+		SHA1_NI_SCHED(g);					\
+	E = _mm_sha1nexte_epu32(E_prev, M[(g) & 3]);			\
+	E_prev = ABCD;							\
+	ABCD = _mm_sha1rnds4_epu32(ABCD, E, (g) / 5);			\
+} while (0)
+
+__attribute__((target("sha,sse4.1")))
+static void sha1_ni_block(u32 *state, const u8 *data, unsigned blocks)
+{
+	const __m128i bswap = _mm_set_epi64x(0x0001020304050607ULL,
+					     0x08090a0b0c0d0e0fULL);
+	__m128i ABCD, ABCD_save, E, E_prev, E_save;
+	__m128i M[4];
+	unsigned i;
+
+	ABCD = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)state),
+				 0x1B);
+	E_save = _mm_set_epi32(state[4], 0, 0, 0);
+
+	while (blocks--) {
+		ABCD_save = ABCD;
+
+		for (i = 0; i < 4; i++)
+			M[i] = _mm_shuffle_epi8(_mm_loadu_si128(
+				(const __m128i *)(data + i * 16)), bswap);
+
+		E = _mm_add_epi32(E_save, M[0]);
+		E_prev = ABCD;
+		ABCD = _mm_sha1rnds4_epu32(ABCD, E, 0);
+
+		SHA1_NI_ROUNDS(1);
+		SHA1_NI_ROUNDS(2);
+		SHA1_NI_ROUNDS(3);
+		SHA1_NI_ROUNDS(4);
+		SHA1_NI_ROUNDS(5);
+		SHA1_NI_ROUNDS(6);
+		SHA1_NI_ROUNDS(7);
+		SHA1_NI_ROUNDS(8);
+		SHA1_NI_ROUNDS(9);
+		SHA1_NI_ROUNDS(10);
+		SHA1_NI_ROUNDS(11);
+		SHA1_NI_ROUNDS(12);
+		SHA1_NI_ROUNDS(13);
+		SHA1_NI_ROUNDS(14);
+		SHA1_NI_ROUNDS(15);
+		SHA1_NI_ROUNDS(16);
+		SHA1_NI_ROUNDS(17);
+		SHA1_NI_ROUNDS(18);
+		SHA1_NI_ROUNDS(19);
+
+		E_save = _mm_sha1nexte_epu32(E_prev, E_save);
+		ABCD = _mm_add_epi32(ABCD, ABCD_save);
+		data += SHA1_BLOCK_SIZE;
+	}
+
+	_mm_storeu_si128((__m128i *)state, _mm_shuffle_epi32(ABCD, 0x1B));
+	state[4] = _mm_extract_epi32(E_save, 3);
+}
+
+static bool sha1_ni_usable(void)
+{
+	unsigned a, b, c, d;
+
+	if (!__get_cpuid(1, &a, &b, &c, &d) ||
+	    !(c & bit_SSSE3) || !(c & bit_SSE4_1))
+		return false;
+
+	if (!__get_cpuid_count(7, 0, &a, &b, &c, &d))
+		return false;
+
+	return (b & (1 << 29)) != 0; /* SHA */
+}
+#endif /* def SHA1_HAVE_NI */
+
+struct crypto_shash *crypto_alloc_shash(const char *alg_name,
+					u32 type __unused, u32 mask __unused)
+{
+	struct crypto_shash *tfm;
+
+	if (strcmp(alg_name, "sha1"))
+		return ERR_PTR(-ENOENT);
+
+	tfm = kzalloc(sizeof(*tfm), GFP_KERNEL);
+	if (!tfm)
+		return ERR_PTR(-ENOMEM);
+
+	tfm->block_fn = sha1_generic_block;
+#ifdef SHA1_HAVE_NI
+	if (sha1_ni_usable())
+		tfm->block_fn = sha1_ni_block;
+#endif
+	return tfm;
+}
+
+void crypto_free_shash(struct crypto_shash *tfm)
+{
+	kfree(tfm);
+}
+
+unsigned crypto_shash_descsize(struct crypto_shash *tfm __unused)
+{
+	return sizeof(struct sha1_state);
+}
+
+unsigned crypto_shash_statesize(struct crypto_shash *tfm __unused)
+{
+	return sizeof(struct sha1_state);
+}
+
+int crypto_shash_init(struct shash_desc *desc)
+{
+	struct sha1_state *sctx = shash_desc_ctx(desc);
+
+	sctx->count = 0;
+	sctx->state[0] = SHA1_H0;
+	sctx->state[1] = SHA1_H1;
+	sctx->state[2] = SHA1_H2;
+	sctx->state[3] = SHA1_H3;
+	sctx->state[4] = SHA1_H4;
+	return 0;
+}
+
+int crypto_shash_update(struct shash_desc *desc, const u8 *data,
+			unsigned len)
+{
+	struct sha1_state *sctx = shash_desc_ctx(desc);
+	unsigned partial = sctx->count % SHA1_BLOCK_SIZE;
+	unsigned blocks;
+
+	sctx->count += len;
+
+	if (partial) {
+		unsigned fill = SHA1_BLOCK_SIZE - partial;
+
+		if (len < fill) {
+			memcpy(sctx->buffer + partial, data, len);
+			return 0;
+		}
+		memcpy(sctx->buffer + partial, data, fill);
+		desc->tfm->block_fn(sctx->state, sctx->buffer, 1);
+		data += fill;
+		len -= fill;
+	}
+
+	blocks = len / SHA1_BLOCK_SIZE;
+	if (blocks) {
+		desc->tfm->block_fn(sctx->state, data, blocks);
+		data += blocks * SHA1_BLOCK_SIZE;
+		len -= blocks * SHA1_BLOCK_SIZE;
+	}
+
+	memcpy(sctx->buffer, data, len);
+	return 0;
+}
+
+int crypto_shash_final(struct shash_desc *desc, u8 *out)
+{
+	struct sha1_state *sctx = shash_desc_ctx(desc);
+	unsigned partial = sctx->count % SHA1_BLOCK_SIZE;
+	u64 bits = sctx->count << 3;
+	unsigned i;
+
+	sctx->buffer[partial++] = 0x80;
+	if (partial > SHA1_BLOCK_SIZE - sizeof(bits)) {
+		memset(sctx->buffer + partial, 0, SHA1_BLOCK_SIZE - partial);
+		desc->tfm->block_fn(sctx->state, sctx->buffer, 1);
+		partial = 0;
+	}
+	memset(sctx->buffer + partial, 0,
+	       SHA1_BLOCK_SIZE - sizeof(bits) - partial);
+	put_unaligned_be64(bits, sctx->buffer + SHA1_BLOCK_SIZE - sizeof(bits));
+	desc->tfm->block_fn(sctx->state, sctx->buffer, 1);
+
+	for (i = 0; i < SHA1_DIGEST_SIZE / 4; i++)
+		put_unaligned_be32(sctx->state[i], out + i * 4);
+
+	memset(sctx, 0, sizeof(*sctx));
+	return 0;
+}
+
+int crypto_shash_export(struct shash_desc *desc, void *out)
+{
+	memcpy(out, shash_desc_ctx(desc), sizeof(struct sha1_state));
+	return 0;
+}
+
+int crypto_shash_import(struct shash_desc *desc, const void *in)
+{
+	memcpy(shash_desc_ctx(desc), in, sizeof(struct sha1_state));
+	return 0;
+}
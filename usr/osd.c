@@ -57,10 +57,17 @@ static void usage(void)
 	static char msg[] = {
 	"usage: osdblk COMMAND --pid=pid_no --obj=obj_no --length=ob_size /dev/osdX\n"
 	"\n"
+	"       osdblk COLLECTION_COMMAND --pid=pid_no --obj=col_no /dev/osdX\n"
+	"\n"
+	"       osdblk PARTITION_COMMAND --pid=pid_no /dev/osdX\n"
+	"\n"
 	"COMMAND is one of: --create | --remove | --resize\n"
 	"--create | -c\n"
 	"        Create a new object. If object exist returns error\n"
 	"        --length can be used to denote an initial size\n"
+	"        --cid can be used to make it a member of a collection\n"
+	"        With --count, creates that many objects with ids chosen by\n"
+	"        the target, --oid is then ignored\n"
 	"\n"
 	"--remove\n"
 	"        remove an existing object. If does not exist does nothing\n"
@@ -70,6 +77,30 @@ static void usage(void)
 	"        Resize an existing object. If does not exist errors\n"
 	"        If --length=0 then does nothing (Only check for existance)\n"
 	"\n"
+	"COLLECTION_COMMAND is one of: --create-collection | --remove-collection\n"
+	"--create-collection\n"
+	"        Create a new collection. If collection exist returns error\n"
+	"\n"
+	"--remove-collection\n"
+	"        Remove all the objects that are members of the collection then\n"
+	"        the collection itself. Members are removed with a single\n"
+	"        command on OSD2 targets\n"
+	"\n"
+	"PARTITION_COMMAND is one of (OSD2 only): --snapshot | --clone |\n"
+	"                  --detach-clone | --refresh | --restore\n"
+	"--snapshot=new_pid\n"
+	"        Create new_pid as a read-only snapshot of partition pid_no\n"
+	"--clone=new_pid\n"
+	"        Create new_pid as a writable clone of partition pid_no\n"
+	"--detach-clone\n"
+	"        Detach clone partition pid_no from its source\n"
+	"--refresh\n"
+	"        Bring snapshot or clone partition pid_no up to date\n"
+	"--restore=snap_pid\n"
+	"        Restore partition pid_no from its snapshot snap_pid\n"
+	"        All of these are done on the target without copying data,\n"
+	"        for example to snapshot a whole exofs file system\n"
+	"\n"
 	"--pid=pid_no | -p pid_no\n"
 	"       pid_no is the partition 64bit number of the object in question\n"
 	"       Both 0xabc hex or decimal anotation can be used\n"
@@ -78,6 +109,13 @@ static void usage(void)
 	"       obj_no is the object 64bit number of the object in question\n"
 	"       Both 0xabc hex or decimal anotation can be used\n"
 	"\n"
+	"--cid=col_no\n"
+	"       col_no is the collection 64bit number the new object is added to\n"
+	"       Both 0xabc hex or decimal anotation can be used\n"
+	"\n"
+	"--count=num | -n num\n"
+	"       Number of objects to create, at most 65535\n"
+	"\n"
 	"--length=size | -l size\n"
 	"       \"size\" is the new size of the object to be set\n"
 	"       0xhex or decimal can be used. G, M, K can be appended to the\n"
@@ -120,9 +158,9 @@ static u64 ullwithGMK(char *optarg)
 }
 
 static void osdblk_make_credential(u8 *creds, struct osd_obj_id *obj,
-				   bool is_v1)
+				   bool is_collection, bool is_v1)
 {
-	osd_sec_init_nosec_doall_caps(creds, obj, false, is_v1);
+	osd_sec_init_nosec_doall_caps(creds, obj, is_collection, is_v1);
 }
 
 static int osdblk_exec(struct osd_request *or, u8 *cred)
@@ -170,7 +208,7 @@ static int do_resize(struct osd_dev *od, struct osd_obj_id *obj, u64 size)
 	if (unlikely(!or))
 		return -ENOMEM;
 
-	osdblk_make_credential(creds, obj, osd_req_is_ver1(or));
+	osdblk_make_credential(creds, obj, false, osd_req_is_ver1(or));
 
 	osd_req_set_attributes(or, obj);
 	osd_req_add_set_attr_list(or, &attr_logical_length, 1);
@@ -188,16 +226,21 @@ static int do_resize(struct osd_dev *od, struct osd_obj_id *obj, u64 size)
 	return 0;
 }
 
-static int do_create(struct osd_dev *od, struct osd_obj_id *obj, u64 size)
+static int do_create(struct osd_dev *od, struct osd_obj_id *obj, u64 size,
+		     osd_id cid)
 {
 	struct osd_request *or = osd_start_request(od, GFP_KERNEL);
+	__be64 be_cid = cpu_to_be64(cid);
 	u8 creds[OSD_CAP_LEN];
+	struct osd_attr attr_membership = ATTR_SET(
+		OSD_APAGE_OBJECT_COLLECTIONS, OSD_ATTR_OC_COLLECTION_FIRST,
+		sizeof(be_cid), &be_cid);
 	int ret;
 
 	if (unlikely(!or))
 		return -ENOMEM;
 
-	osdblk_make_credential(creds, obj, osd_req_is_ver1(or));
+	osdblk_make_credential(creds, obj, false, osd_req_is_ver1(or));
 
 	/* Create partition OK to fail (all ready exist) */
 	osd_req_create_partition(or, obj->partition);
@@ -212,18 +255,50 @@ static int do_create(struct osd_dev *od, struct osd_obj_id *obj, u64 size)
 		return -ENOMEM;
 
 	osd_req_create_object(or, obj);
+	if (cid)
+		osd_req_add_set_attr_list(or, &attr_membership, 1);
 	ret = osdblk_exec(or, creds);
 	osd_end_request(or);
 
 	if (ret)
 		return ret;
 
-	OSDBLK_INFO("Created: pid=0x%llx oid=0x%llx\n",
-		_LLU(obj->partition), _LLU(obj->id));
+	OSDBLK_INFO("Created: pid=0x%llx oid=0x%llx cid=0x%llx\n",
+		_LLU(obj->partition), _LLU(obj->id), _LLU(cid));
 
 	return do_resize(od, obj, size);
 }
 
+static int do_create_many(struct osd_dev *od, osd_id partition,
+			  unsigned count)
+{
+	struct osd_request *or = osd_start_request(od, GFP_KERNEL);
+	struct osd_obj_id par = {.partition = partition, .id = 0};
+	u8 creds[OSD_CAP_LEN];
+	osd_id first_id;
+	int ret;
+
+	if (unlikely(!or))
+		return -ENOMEM;
+
+	osdblk_make_credential(creds, &par, false, osd_req_is_ver1(or));
+
+	ret = osd_req_create_objects(or, partition, count);
+	if (!ret)
+		ret = osdblk_exec(or, creds);
+	if (!ret)
+		ret = osd_req_decode_created_objects(or, &first_id);
+	osd_end_request(or);
+
+	if (ret)
+		return ret;
+
+	OSDBLK_INFO("Created: pid=0x%llx oid=0x%llx..0x%llx\n",
+		_LLU(partition), _LLU(first_id), _LLU(first_id + count - 1));
+
+	return 0;
+}
+
 static int do_remove(struct osd_dev *od, struct osd_obj_id *obj)
 {
 	struct osd_request *or = osd_start_request(od, GFP_KERNEL);
@@ -233,7 +308,7 @@ static int do_remove(struct osd_dev *od, struct osd_obj_id *obj)
 	if (unlikely(!or))
 		return -ENOMEM;
 
-	osdblk_make_credential(creds, obj, osd_req_is_ver1(or));
+	osdblk_make_credential(creds, obj, false, osd_req_is_ver1(or));
 	osd_req_remove_object(or, obj);
 	ret = osdblk_exec(or, creds);
 	osd_end_request(or);
@@ -247,14 +322,137 @@ static int do_remove(struct osd_dev *od, struct osd_obj_id *obj)
 	return 0;
 }
 
+static int do_create_collection(struct osd_dev *od, struct osd_obj_id *col)
+{
+	struct osd_request *or = osd_start_request(od, GFP_KERNEL);
+	u8 creds[OSD_CAP_LEN];
+	int ret;
+
+	if (unlikely(!or))
+		return -ENOMEM;
+
+	osdblk_make_credential(creds, col, true, osd_req_is_ver1(or));
+	osd_req_create_collection(or, col);
+	ret = osdblk_exec(or, creds);
+	osd_end_request(or);
+
+	if (ret)
+		return ret;
+
+	OSDBLK_INFO("Created collection: pid=0x%llx cid=0x%llx\n",
+		_LLU(col->partition), _LLU(col->id));
+
+	return 0;
+}
+
+static int do_remove_collection(struct osd_dev *od, struct osd_obj_id *col)
+{
+	struct osd_request *or = osd_start_request(od, GFP_KERNEL);
+	u8 creds[OSD_CAP_LEN];
+	int ret;
+
+	if (unlikely(!or))
+		return -ENOMEM;
+
+	osdblk_make_credential(creds, col, true, osd_req_is_ver1(or));
+
+	/* OSD1 has no bulk removal, the collection must already be empty */
+	if (!osd_req_is_ver1(or)) {
+		osd_req_remove_member_objects(or, col);
+		ret = osdblk_exec(or, creds);
+		osd_end_request(or);
+
+		if (ret)
+			return ret;
+
+		or = osd_start_request(od, GFP_KERNEL);
+		if (unlikely(!or))
+			return -ENOMEM;
+	}
+
+	osd_req_remove_collection(or, col);
+	ret = osdblk_exec(or, creds);
+	osd_end_request(or);
+
+	if (ret)
+		return ret;
+
+	OSDBLK_INFO("Removed collection: pid=0x%llx cid=0x%llx\n",
+		_LLU(col->partition), _LLU(col->id));
+
+	return 0;
+}
+
+enum osd_par_cmd {
+	osd_par_snapshot,
+	osd_par_clone,
+	osd_par_detach,
+	osd_par_refresh,
+	osd_par_restore,
+};
+
+static int do_partition_cmd(struct osd_dev *od, osd_id partition,
+			    osd_id other_partition, enum osd_par_cmd cmd)
+{
+	struct osd_request *or = osd_start_request(od, GFP_KERNEL);
+	struct osd_obj_id par = {.partition = partition, .id = 0};
+	u8 creds[OSD_CAP_LEN];
+	int ret;
+
+	if (unlikely(!or))
+		return -ENOMEM;
+
+	if (osd_req_is_ver1(or)) {
+		osd_end_request(or);
+		OSDBLK_ERR("Snapshots and clones need an OSD2 target\n");
+		return -EOPNOTSUPP;
+	}
+
+	osdblk_make_credential(creds, &par, false, false);
+
+	switch (cmd) {
+	case osd_par_snapshot:
+		osd_req_create_snapshot(or, partition, other_partition);
+		break;
+	case osd_par_clone:
+		osd_req_create_clone(or, partition, other_partition);
+		break;
+	case osd_par_detach:
+		osd_req_detach_clone(or, partition);
+		break;
+	case osd_par_refresh:
+		osd_req_refresh_snapshot_clone(or, partition);
+		break;
+	case osd_par_restore:
+		osd_req_restore_partition_from_snapshot(or, partition,
+							other_partition);
+		break;
+	}
+
+	ret = osdblk_exec(or, creds);
+	osd_end_request(or);
+
+	if (ret)
+		return ret;
+
+	OSDBLK_INFO("Done: pid=0x%llx other_pid=0x%llx\n",
+		_LLU(partition), _LLU(other_partition));
+
+	return 0;
+}
+
 enum osd_todo {
 	osd_none = 0,
 	osd_create,
 	osd_remove,
 	osd_resize,
+	osd_create_col,
+	osd_remove_col,
+	osd_partition,
 };
 
-static int _do(char *path, struct osd_obj_id *obj, u64 size,
+static int _do(char *path, struct osd_obj_id *obj, u64 size, osd_id cid,
+	       unsigned count, osd_id other_pid, enum osd_par_cmd par_cmd,
 	       enum osd_todo todo)
 {
 	struct osd_dev *od;
@@ -266,7 +464,10 @@ static int _do(char *path, struct osd_obj_id *obj, u64 size,
 
 	switch (todo) {
 	case osd_create:
-		ret = do_create(od, obj, size);
+		if (count)
+			ret = do_create_many(od, obj->partition, count);
+		else
+			ret = do_create(od, obj, size, cid);
 		break;
 	case osd_remove:
 		ret = do_remove(od, obj);
@@ -274,6 +475,15 @@ static int _do(char *path, struct osd_obj_id *obj, u64 size,
 	case osd_resize:
 		ret = do_resize(od, obj, size);
 		break;
+	case osd_create_col:
+		ret = do_create_collection(od, obj);
+		break;
+	case osd_remove_col:
+		ret = do_remove_collection(od, obj);
+		break;
+	case osd_partition:
+		ret = do_partition_cmd(od, obj->partition, other_pid, par_cmd);
+		break;
 	default:
 		usage();
 		return 1;
@@ -294,16 +504,32 @@ int main(int argc, char *argv[])
 		{.name = "pid", .has_arg = 1, .flag = NULL, .val =  'p'} ,
 		{.name = "oid", .has_arg = 1, .flag = NULL, .val =  'o'} ,
 		{.name = "length", .has_arg = 1, .flag = NULL, .val = 'l'} ,
+		{.name = "cid", .has_arg = 1, .flag = NULL, .val = 'i'} ,
+		{.name = "count", .has_arg = 1, .flag = NULL, .val = 'n'} ,
+		{.name = "create-collection", .has_arg = 0, .flag = NULL,
+		 .val = 'C'} ,
+		{.name = "remove-collection", .has_arg = 0, .flag = NULL,
+		 .val = 'R'} ,
+		{.name = "snapshot", .has_arg = 1, .flag = NULL, .val = 'S'} ,
+		{.name = "clone", .has_arg = 1, .flag = NULL, .val = 'K'} ,
+		{.name = "detach-clone", .has_arg = 0, .flag = NULL,
+		 .val = 'D'} ,
+		{.name = "refresh", .has_arg = 0, .flag = NULL, .val = 'F'} ,
+		{.name = "restore", .has_arg = 1, .flag = NULL, .val = 'T'} ,
 
 		{.name = 0, .has_arg = 0, .flag = 0, .val = 0} ,
 	};
 	struct osd_obj_id obj = {.id = 0};
 	enum osd_todo todo = osd_none;
 	u64 size = 0;
+	osd_id cid = 0;
+	unsigned count = 0;
+	osd_id other_pid = 0;
+	enum osd_par_cmd par_cmd = osd_par_snapshot;
 	char op;
 	int err;
 
-	while ((op = getopt_long(argc, argv, "csp:o:l:", opt, NULL)) != -1) {
+	while ((op = getopt_long(argc, argv, "csp:o:l:n:", opt, NULL)) != -1) {
 		switch (op) {
 		case 'c':
 			todo = osd_create;
@@ -314,6 +540,26 @@ int main(int argc, char *argv[])
 		case 's':
 			todo = osd_resize;
 			break;
+		case 'C':
+			todo = osd_create_col;
+			break;
+		case 'R':
+			todo = osd_remove_col;
+			break;
+		case 'S':
+		case 'K':
+		case 'T':
+			other_pid = strtoll(optarg, NULL, 0);
+			/* fall through */
+		case 'D':
+		case 'F':
+			todo = osd_partition;
+			par_cmd = (op == 'S') ? osd_par_snapshot :
+				  (op == 'K') ? osd_par_clone :
+				  (op == 'T') ? osd_par_restore :
+				  (op == 'D') ? osd_par_detach :
+						osd_par_refresh;
+			break;
 
 		case 'p':
 			obj.partition = strtoll(optarg, NULL, 0);
@@ -325,6 +571,12 @@ int main(int argc, char *argv[])
 		case 'l':
 			size = ullwithGMK(optarg);
 			break;
+		case 'i':
+			cid = strtoll(optarg, NULL, 0);
+			break;
+		case 'n':
+			count = strtoul(optarg, NULL, 0);
+			break;
 		}
 	}
 
@@ -336,12 +588,14 @@ int main(int argc, char *argv[])
 		return 1;
 	}
 
-	if ((todo == osd_none) || !obj.partition || !obj.id) {
+	if ((todo == osd_none) || !obj.partition ||
+	    (!obj.id && !(todo == osd_create && count) &&
+	     (todo != osd_partition))) {
 		usage();
 		return 1;
 	}
 
-	err = _do(argv[0], &obj, size, todo);
+	err = _do(argv[0], &obj, size, cid, count, other_pid, par_cmd, todo);
 	if (err)
 		OSDBLK_ERR("Error: %s\n", strerror(err));
 